@@ -9,17 +9,25 @@ CONFIG += c++17
 #DEFINES += QT_DISABLE_DEPRECATED_BEFORE=0x060000    # disables all the APIs deprecated before Qt 6.0.0
 
 SOURCES += \
+    generator.cpp \
     grammer.cpp \
     main.cpp \
     mainwindow.cpp
 
 HEADERS += \
+    generator.h \
     grammer.h \
     mainwindow.h
 
 FORMS += \
     mainwindow.ui
 
+# 本机分析服务(--daemon)，依赖Unix域套接字
+unix {
+    SOURCES += parseserver.cpp
+    HEADERS += parseserver.h
+}
+
 # Default rules for deployment.
 qnx: target.path = /tmp/$${TARGET}/bin
 else: unix:!android: target.path = /opt/$${TARGET}/bin
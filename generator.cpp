@@ -0,0 +1,245 @@
+#include "generator.h"
+#include <climits>
+
+using namespace std;
+
+// 推导不出句子的符号的最短句长
+static const size_t INFINITE_LENGTH = SIZE_MAX;
+
+Generator::Generator(const Grammer& grammer, GeneratorOptions options)
+    : grammer(grammer), options(options), seed(options.seed) {
+    int symbols = grammer.symbolCount();
+    int productions = grammer.productionCount();
+    alternatives.resize(symbols);
+    rights.resize(productions);
+    weights.assign(productions, 1.0);
+    for (int id = 0; id < productions; ++id) {
+        const Production& production = grammer.getProduction(id);
+        alternatives[production.symbol].push_back(id);
+        for (auto& token : grammer.getProductions(production.key)[production.rawsIndex]) {
+            if (token != EPSILON)
+                rights[id].push_back(grammer.symbolId(token));
+        }
+    }
+    for (int id = 0; id < grammer.terminalCount(); ++id) {
+        const string& token = grammer.symbolName(id);
+        letters.push_back(token[0]);
+        if (token != EPSILON && token != END_FLAG && token.size() == 1)
+            alphabet.push_back(token[0]);
+    }
+    initDepth();
+}
+
+void Generator::initDepth() {
+    int symbols = grammer.symbolCount();
+    int terminals = grammer.terminalCount();
+    minLength.assign(symbols, INFINITE_LENGTH);
+    minDepth.assign(symbols, INT_MAX);
+    for (int id = 0; id < terminals; ++id) {
+        minLength[id] = 1;
+        minDepth[id] = 0;
+    }
+    productionLength.assign(rights.size(), INFINITE_LENGTH);
+    productionDepth.assign(rights.size(), INT_MAX);
+    // 按(最短句长, 最小推导深度)取最小，迭代到不再变化
+    // 沿每个非终结符号取值最小的推导式展开，右部符号的深度严格递减，因此一定能终止
+    bool shouldUpdate = true;
+    while (shouldUpdate) {
+        shouldUpdate = false;
+        for (int id = 0; id < (int)rights.size(); ++id) {
+            size_t length = 0;
+            int depth = 0;
+            for (int symbol : rights[id]) {
+                if (minLength[symbol] == INFINITE_LENGTH) {
+                    length = INFINITE_LENGTH;
+                    break;
+                }
+                length += minLength[symbol];
+                depth = max(depth, minDepth[symbol]);
+            }
+            if (length == INFINITE_LENGTH)
+                continue;
+            depth += 1;
+            productionLength[id] = length;
+            productionDepth[id] = depth;
+            int key = grammer.getProduction(id).symbol;
+            if (length < minLength[key] || (length == minLength[key] && depth < minDepth[key])) {
+                minLength[key] = length;
+                minDepth[key] = depth;
+                shouldUpdate = true;
+            }
+        }
+    }
+    growable.assign(symbols, 0);
+    for (int id = 0; id < (int)rights.size(); ++id) {
+        int key = grammer.getProduction(id).symbol;
+        if (productionLength[id] != INFINITE_LENGTH && productionLength[id] > minLength[key])
+            growable[key] = 1;
+    }
+}
+
+unsigned long long Generator::roll() {
+    // splitmix64，比mt19937快，同一种子的序列固定
+    unsigned long long z = (seed += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+bool Generator::valid() const {
+    int start = grammer.symbolId(grammer.getStart());
+    return start >= 0 && minLength[start] != INFINITE_LENGTH;
+}
+
+void Generator::setWeight(int production, double weight) {
+    if (production >= 0 && production < (int)weights.size())
+        weights[production] = weight;
+}
+
+int Generator::choose(int symbol, size_t slack, bool last) {
+    candidates.clear();
+    if (slack == 0) {
+        // 没有余量：取最短句长下推导深度最小的推导式
+        for (int id : alternatives[symbol]) {
+            if (productionLength[id] == minLength[symbol] && productionDepth[id] == minDepth[symbol])
+                return id;
+        }
+    }
+    // 有余量：其他待展开符号还能变长时随机决定是否变长，使余量分散到各处
+    // 最后一个能变长的符号在放得下的变长推导式中选择，直到余量用完，句长因此接近目标
+    bool grow = last || roll() % 2;
+    for (int pass = grow ? 0 : 1; pass < 2 && candidates.empty(); ++pass) {
+        for (int id : alternatives[symbol]) {
+            if (productionLength[id] == INFINITE_LENGTH)
+                continue;
+            size_t extra = productionLength[id] - minLength[symbol];
+            if (pass == 0 ? extra > 0 && extra <= slack : extra == 0)
+                candidates.push_back(id);
+        }
+    }
+    if (!options.weighted)
+        return candidates[roll() % candidates.size()];
+    double total = 0;
+    for (int id : candidates) {
+        total += weights[id];
+    }
+    double point = (roll() >> 11) * (1.0 / (1ULL << 53)) * total;
+    for (int id : candidates) {
+        point -= weights[id];
+        if (point < 0)
+            return id;
+    }
+    return candidates.back();
+}
+
+void Generator::next(string& out) {
+    if (!valid())
+        return;
+    int start = grammer.symbolId(grammer.getStart());
+    int terminals = grammer.terminalCount();
+    size_t reserve = minLength[start]; // 待展开符号至少还会产生的句长
+    size_t emitted = 0; // 已产生的句长
+    size_t open = 0; // 待展开的能变长的非终结符号个数
+    size_t steps = 0, limit = options.length * 4 + 64; // 展开次数上限，超出后只走最短推导，避免单产生式成环
+    pending.assign(1, start);
+    open = growable[start];
+    while (!pending.empty()) {
+        int symbol = pending.back();
+        pending.pop_back();
+        reserve -= minLength[symbol];
+        open -= growable[symbol];
+        if (symbol < terminals) {
+            out += letters[symbol];
+            emitted++;
+            continue;
+        }
+        size_t used = emitted + reserve + minLength[symbol];
+        size_t slack = ++steps > limit || used >= options.length ? 0 : options.length - used;
+        int id = choose(symbol, slack, open == 0);
+        reserve += productionLength[id];
+        const vector<int>& right = rights[id];
+        for (auto it = right.rbegin(); it != right.rend(); ++it) {
+            pending.push_back(*it);
+            open += growable[*it];
+        }
+    }
+}
+
+string Generator::next() {
+    string sentence;
+    next(sentence);
+    return sentence;
+}
+
+void Generator::mutate(string& sentence) {
+    if (sentence.empty() && alphabet.empty())
+        return;
+    size_t pos = sentence.empty() ? 0 : roll() % (sentence.size() + 1);
+    int op = sentence.empty() ? 1 : roll() % 4;
+    if (alphabet.empty() && (op == 1 || op == 2))
+        op = 0;
+    switch (op) {
+    case 0: // 删除
+        sentence.erase(min(pos, sentence.size() - 1), 1);
+        break;
+    case 1: // 插入
+        sentence.insert(sentence.begin() + pos, alphabet[roll() % alphabet.size()]);
+        break;
+    case 2: // 替换
+        sentence[min(pos, sentence.size() - 1)] = alphabet[roll() % alphabet.size()];
+        break;
+    default: // 交换相邻字符
+        if (sentence.size() > 1) {
+            pos = min(pos, sentence.size() - 2);
+            swap(sentence[pos], sentence[pos + 1]);
+        }
+        break;
+    }
+}
+
+bool Generator::nearMiss(string& out) {
+    // 改动后为空或仍合法则重试；非SLR文法的分析结果不可信，不生成
+    static const int attempts = 32;
+    string sentence;
+    for (int i = 0; i < attempts && valid() && grammer.slr(); ++i) {
+        sentence.clear();
+        next(sentence);
+        mutate(sentence);
+        if (!sentence.empty() && !grammer.accepts(sentence)) {
+            out += sentence;
+            return true;
+        }
+    }
+    return false;
+}
+
+string Generator::nearMiss() {
+    string sentence;
+    nearMiss(sentence);
+    return sentence;
+}
+
+size_t Generator::generate(ostream& os, size_t count, bool invalid) {
+    // 攒够一块再写出，减少流操作
+    static const size_t blockSize = 1 << 20;
+    string buffer;
+    buffer.reserve(blockSize * 2);
+    size_t written = 0;
+    for (size_t i = 0; i < count; ++i) {
+        if (invalid) {
+            if (!nearMiss(buffer))
+                break;
+        } else {
+            next(buffer);
+        }
+        buffer += '\n';
+        if (buffer.size() >= blockSize) {
+            os.write(buffer.data(), buffer.size());
+            written += buffer.size();
+            buffer.clear();
+        }
+    }
+    os.write(buffer.data(), buffer.size());
+    written += buffer.size();
+    return written;
+}
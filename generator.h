@@ -0,0 +1,52 @@
+#ifndef GENERATOR_H
+#define GENERATOR_H
+
+#include <ostream>
+#include <string>
+#include <vector>
+#include "grammer.h"
+
+// 句子生成选项
+struct GeneratorOptions {
+    size_t length = 16; // 目标句长(终结符号个数)
+    bool weighted = false; // 按推导式权重选择，否则均匀选择
+    unsigned long long seed = 0; // 随机种子，相同种子生成相同的句子序列
+};
+
+// 按文法随机生成句子，用于构造分析程序的压力测试输入
+class Generator {
+private:
+    const Grammer& grammer;
+    GeneratorOptions options;
+    unsigned long long seed; // 随机数状态
+
+    std::vector<std::vector<int> > rights; // 推导式编号 -> 右部符号编号(不含EPSILON)
+    std::vector<std::vector<int> > alternatives; // 非终结符号编号 -> 其推导式编号
+    std::vector<int> minDepth; // 符号编号 -> 最小推导深度，终结符号为0
+    std::vector<size_t> minLength; // 符号编号 -> 能推导出的最短句长
+    std::vector<size_t> productionLength; // 推导式编号 -> 右部能推导出的最短句长
+    std::vector<int> productionDepth; // 推导式编号 -> 右部的最小推导深度+1
+    std::vector<char> growable; // 符号编号 -> 是否有比最短句长更长的推导式
+    std::vector<double> weights; // 推导式编号 -> 权重
+    std::vector<char> letters; // 终结符号编号 -> 字符
+    std::vector<char> alphabet; // 可出现在句子中的终结符号
+    std::vector<int> pending; // 待展开的符号栈
+    std::vector<int> candidates; // 可选的推导式
+
+    unsigned long long roll(); // 下一个随机数
+    void initDepth(); // 计算最小推导深度与最短句长
+    int choose(int, size_t, bool); // 按余量选择推导式，最后一个可变长的待展开符号必须变长
+    void mutate(std::string&); // 对句子做一次随机改动
+public:
+    Generator(const Grammer&, GeneratorOptions = GeneratorOptions());
+
+    bool valid() const; // 开始符号能否推导出句子
+    void setWeight(int, double); // 设置推导式的权重(weighted时生效)
+    void next(std::string&); // 生成一个合法句子，追加到参数末尾
+    std::string next();
+    bool nearMiss(std::string&); // 生成一个与合法句子只差一处改动的非法句子，追加到参数末尾，构造不出或非SLR文法返回false
+    std::string nearMiss();
+    size_t generate(std::ostream&, size_t, bool invalid = false); // 生成若干句子，每行一个，返回写出的字节数
+};
+
+#endif // GENERATOR_H
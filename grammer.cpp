@@ -1,11 +1,13 @@
 #include "grammer.h"
+#include <algorithm>
 #include <iostream>
 #include <queue>
 #include <sstream>
+#include <thread>
 
 using namespace std;
 
-Grammer::Grammer(string input) {
+Grammer::Grammer(string input, GrammerOptions options) : options(options) {
     vector<string> lines;
     int from = 0, i = 0;
     for (i = 0; i < input.size(); ++i) {
@@ -21,8 +23,48 @@ Grammer::Grammer(string input) {
         error = "未输入任何文法";
         return;
     }
+    int level = 0; // 当前声明的优先级
+    bool ebnf = false; // 之后的文法是否按EBNF解析
     for (int i = 0; i < lines.size(); ++i) {
         string line = lines[i];
+        size_t head = line.find_first_not_of(' ');
+        if (head != string::npos && line.compare(head, 5, "%ebnf") == 0) {
+            ebnf = true;
+            continue;
+        }
+        if (ebnf && head != string::npos && line[head] != '%') {
+            // EBNF：左部->右部，右部可含{}、[]、()、*、?
+            size_t arrow = line.find("->");
+            string key;
+            for (size_t j = 0; j < arrow && j < line.size(); ++j) {
+                if (line[j] != ' ')
+                    key += line[j];
+            }
+            if (arrow == string::npos || key.empty()) {
+                error = "文法输入有误";
+                return;
+            }
+            if (key.size() > 1) {
+                error = key.find('|') == string::npos ? "文法左式不支持多字符" : "|符号不能出现在左值";
+                return;
+            }
+            if (start.empty())
+                start = key;
+            size_t pos = arrow + 2;
+            vector<vector<string> > alternatives;
+            if (!parseEbnf(key, line, pos, 0, alternatives))
+                return;
+            for (auto& raws : alternatives) {
+                formula[key].push_back(raws);
+            }
+            continue;
+        }
+        if (head != string::npos && line[head] == '%') {
+            // 优先级声明，越靠后优先级越高
+            if (!parseDeclaration(line.substr(head), ++level))
+                return;
+            continue;
+        }
         string key;
         vector<string> raws;
         bool behind = false;
@@ -63,15 +105,24 @@ Grammer::Grammer(string input) {
         if (!raws.empty()) {
             formula[key].push_back(raws);
         }
-        if (i == 0)
+        if (start.empty())
             start = key;
     }
+    if (start.empty()) {
+        error = "未输入任何文法";
+        return;
+    }
 //    if (formula[start].size() > 1) {
         // 拓广文法
         formula[start + '\''].push_back(vector<string>(1, start));
         start = start + '\'';
 //    }
 
+    // 化简文法
+    reduceGrammer();
+    if (bad())
+        return;
+
     // 构建非终结符号集
     for (auto it = formula.begin(); it != formula.end(); ++it) {
         notEnd.insert(it->first);
@@ -86,28 +137,150 @@ Grammer::Grammer(string input) {
         }
     }
 
+    // 终结符号的First集合为其自身
+    for (auto& token : endSet) {
+        first[token].insert(token);
+    }
+    first[END_FLAG].insert(END_FLAG);
+
     // 初始化First集合元素
     initFirst();
+    // EBNF重复H->H...的内容可以为空时，H->H和H->@使分析无法前进
+    for (auto& helper : helpers) {
+        auto found = formula.find(helper.first);
+        if (found == formula.end())
+            continue;
+        for (auto& raws : found->second) {
+            if (raws.size() < 2 || raws[0] != helper.first)
+                continue;
+            bool nullable = true;
+            for (size_t j = 1; j < raws.size() && nullable; ++j) {
+                nullable = getFirst(raws[j]).count(EPSILON) > 0;
+            }
+            if (nullable) {
+                error = "EBNF重复的内容可以为空: " + helper.second;
+                return;
+            }
+        }
+    }
     // 初始化Follow集合元素
     initFollow();
     // 构建DFA
     initRelation();
+    if (bad())
+        return;
     // 判断是否SLR
     initIsSLR();
+    // 消除单产生式规约
+    if (options.eliminateUnit)
+        initUnitJumps();
+    if (overBudget())
+        return;
+    // 默认规约
+    if (options.defaultReduce)
+        initDefaultReduces();
+    // 生成按编号索引的分析表
+    initTables();
 }
 
-set<string> Grammer::getFirst(string key) {
-    if (!notEnd.count(key)) {
-        // 是终结节点
-        set<string> res;
-        res.insert(key);
-        return res;
+void Grammer::reduceGrammer() {
+    // 不可终止：工作表算法，推导式右部的非终结符号都可终止时，左部可终止
+    map<string, vector<pair<string, int> > > occurs; // 非终结符号 -> 出现在哪些推导式右部
+    map<pair<string, int>, int> pending; // 推导式 -> 右部尚未确认可终止的非终结符号个数
+    set<string> productive;
+    queue<string> ready;
+    for (auto& p : formula) {
+        for (int j = 0; j < (int)p.second.size(); ++j) {
+            int count = 0;
+            for (auto& token : p.second[j]) {
+                if (formula.count(token)) {
+                    occurs[token].push_back(make_pair(p.first, j));
+                    count++;
+                }
+            }
+            pending[make_pair(p.first, j)] = count;
+            if (count == 0 && !productive.count(p.first)) {
+                productive.insert(p.first);
+                ready.push(p.first);
+            }
+        }
+    }
+    while (ready.size()) {
+        string cur = ready.front();
+        ready.pop();
+        for (auto& at : occurs[cur]) {
+            if (--pending[at] == 0 && !productive.count(at.first)) {
+                productive.insert(at.first);
+                ready.push(at.first);
+            }
+        }
     }
-    // 非终结节点，返回其First集
-    return first[key];
+    if (!productive.count(start)) {
+        error = "开始符号无法推导出终结符号串";
+        return;
+    }
+    // 删除不可终止的符号及含有它们的推导式
+    for (auto it = formula.begin(); it != formula.end();) {
+        if (!productive.count(it->first)) {
+            warnings.push_back("非终结符号" + it->first + "无法推导出终结符号串，已删除");
+            it = formula.erase(it);
+            continue;
+        }
+        auto& raws = it->second;
+        for (int j = 0; j < (int)raws.size();) {
+            bool useless = false;
+            for (auto& token : raws[j]) {
+                if (occurs.count(token) && !productive.count(token))
+                    useless = true;
+            }
+            if (useless) {
+                raws.erase(raws.begin() + j);
+                continue;
+            }
+            ++j;
+        }
+        ++it;
+    }
+
+    // 不可达：从开始符号广度优先搜索
+    set<string> reachable;
+    ready.push(start);
+    reachable.insert(start);
+    while (ready.size()) {
+        string cur = ready.front();
+        ready.pop();
+        for (auto& raw : formula[cur]) {
+            for (auto& token : raw) {
+                if (formula.count(token) && !reachable.count(token)) {
+                    reachable.insert(token);
+                    ready.push(token);
+                }
+            }
+        }
+    }
+    for (auto it = formula.begin(); it != formula.end();) {
+        if (!reachable.count(it->first)) {
+            warnings.push_back("非终结符号" + it->first + "从开始符号不可达，已删除");
+            it = formula.erase(it);
+            continue;
+        }
+        ++it;
+    }
+}
+
+// 不存在的符号返回的空集合
+static const set<string> emptySet;
+
+const set<string>& Grammer::getFirst(const string& key) const {
+    // 终结符号的First集合在构造时已设为其自身
+    auto it = first.find(key);
+    return it == first.end() ? emptySet : it->second;
 }
 
-set<string> Grammer::getFollow(string key) { return follow[key]; }
+const set<string>& Grammer::getFollow(const string& key) const {
+    auto it = follow.find(key);
+    return it == follow.end() ? emptySet : it->second;
+}
 
 void Grammer::initFirst() {
     bool shouldUpdate = true;
@@ -247,16 +420,81 @@ void Grammer::extend(int state) {
     extend(dfa[state]);
 }
 
+// 估算的单个元素占用
+static const long long STATE_BYTES = sizeof(vector<Node>); // DFA节点
+static const long long NODE_BYTES = sizeof(Node); // 项目
+static const long long ENTRY_BYTES = sizeof(pair<const string, int>) + 4 * sizeof(void*); // map中的一个关系(含红黑树节点开销)
+
+bool Grammer::charge(size_t& part, long long bytes) {
+    part += bytes;
+    memory.current += bytes;
+    memory.peak = max(memory.peak, memory.current);
+    return !options.maxMemory || memory.current <= options.maxMemory;
+}
+
+bool Grammer::overBudget() {
+    stringstream ss;
+    if (options.maxStates && dfa.size() > options.maxStates) {
+        ss << "DFA节点数超过上限" << options.maxStates;
+    } else if (options.maxMemory && memory.current > options.maxMemory) {
+        ss << "构建分析表的内存超过上限" << options.maxMemory << "字节";
+    } else {
+        return false;
+    }
+    // 统计各非终结符号的项目数，找出导致状态膨胀的非终结符号
+    map<string, size_t> items;
+    for (auto& state : dfa) {
+        for (auto& node : state) {
+            items[node.key]++;
+        }
+    }
+    vector<pair<size_t, string> > ranking;
+    for (auto& p : items) {
+        ranking.push_back(make_pair(p.second, p.first));
+    }
+    sort(ranking.rbegin(), ranking.rend());
+    ss << "，增长主要来自非终结符号:";
+    for (size_t i = 0; i < ranking.size() && i < 3; ++i) {
+        ss << " " << ranking[i].second << "(" << ranking[i].first << "个项目)";
+    }
+    giveUp(ss.str());
+    return true;
+}
+
+void Grammer::giveUp(const string& message) {
+    error = message;
+    isSLR = false;
+    reason.clear();
+    // 释放已生成的部分，峰值保留
+    vector<vector<Node> >().swap(dfa);
+    forwards.clear();
+    backwards.clear();
+    unitJumps.clear();
+    defaultReduces.clear();
+    forwardTable.clear();
+    backwardTable.clear();
+    jumpRows.clear();
+    jumpTable.clear();
+    baseGotos.clear();
+    size_t peak = memory.peak;
+    memory = MemoryUsage();
+    memory.peak = peak;
+}
+
 void Grammer::initRelation() {
     // 初始节点 => start指示的推导式的第一条的第一个符号
     vector<Node> beginState;
     beginState.push_back(Node(start, NodeType::FORWARD, 0, 0));
     dfa.push_back(beginState);
+    charge(memory.dfa, STATE_BYTES + NODE_BYTES);
     isSLR = true; // 暂时先是
     // 遍历每一个DFA节点
     for (int cur = 0; cur < dfa.size(); ++cur) {
         // forwards[cur]和backwards[cur]分别记录了移进和规约关系
+        size_t before = dfa[cur].size();
         extend(cur); // 扩展当前DFA节点(可能右侧项目含有非终结符号)
+        if (!charge(memory.dfa, (dfa[cur].size() - before) * NODE_BYTES) && overBudget())
+            return;
         // 遍历DFA节点上的每一个项目
         for (int it = 0; it < dfa[cur].size(); ++it) {
             Node& item = dfa[cur][it]; // 取出当前项
@@ -270,6 +508,8 @@ void Grammer::initRelation() {
                         stringstream ss;
                         ss << "第" << cur << "个节点中规约项目的Follow集合有交集\n";
                         reason += ss.str();
+                    } else if (!charge(memory.backwards, ENTRY_BYTES) && overBudget()) {
+                        return;
                     }
                     backwards[cur][el] = it;
                 }
@@ -292,24 +532,183 @@ void Grammer::initRelation() {
                 if (!count(next.begin(), next.end(), instance)) {
                     // 如果下一DFA节点中未存在该Instance状态 -> 加入下一DFA节点中
                     dfa[target].push_back(instance);
+                    if (!charge(memory.dfa, NODE_BYTES) && overBudget())
+                        return;
                 }
                 continue;
             }
             // 未存在该移进关系
             vector<Node> perhapsNewState{ instance };
             extend(perhapsNewState);
+            // 临时节点计入峰值
+            long long bytes = STATE_BYTES + perhapsNewState.size() * NODE_BYTES;
+            size_t temporary = 0;
+            charge(temporary, bytes);
             int target = findState(perhapsNewState);
+            charge(temporary, -bytes);
             if (target == -1) {
                 // 该状态不存在于任何DFA节点中 -> 新增一个DFA节点
                 dfa.push_back(perhapsNewState);
                 target = dfa.size() - 1;
+                charge(memory.dfa, bytes);
+                if (overBudget())
+                    return;
             }
             // 加入移进关系
             forwards[cur][raw] = target;
+            if (!charge(memory.forwards, ENTRY_BYTES) && overBudget())
+                return;
         }
     }
 }
 
+bool Grammer::parseDeclaration(const string& line, int level) {
+    Precedence prec{level, LEFT_ASSOC};
+    size_t offset;
+    if (line.compare(0, 5, "%left") == 0) {
+        offset = 5;
+    } else if (line.compare(0, 6, "%right") == 0) {
+        prec.assoc = RIGHT_ASSOC;
+        offset = 6;
+    } else if (line.compare(0, 9, "%nonassoc") == 0) {
+        prec.assoc = NON_ASSOC;
+        offset = 9;
+    } else {
+        error = "不支持的声明: " + line;
+        return false;
+    }
+    for (size_t j = offset; j < line.size(); ++j) {
+        if (line[j] == ' ')
+            continue;
+        // 每个字符都是一个终结符号
+        precedence[string(1, line[j])] = prec;
+    }
+    return true;
+}
+
+// 取出line[from..to]并去掉空格
+static string fragment(const string& line, size_t from, size_t to) {
+    string text;
+    for (size_t j = from; j <= to; ++j) {
+        if (line[j] != ' ')
+            text += line[j];
+    }
+    return text;
+}
+
+bool Grammer::parseEbnf(const string& key, const string& line, size_t& pos, char close, vector<vector<string> >& alternatives) {
+    vector<string> raws;
+    bool empty = true; // 是否还没有任何候选式
+    for (; pos < line.size() && line[pos] != close; ++pos) {
+        char c = line[pos];
+        if (c == ' ')
+            continue;
+        if (c == '|') {
+            alternatives.push_back(raws.empty() ? vector<string>(1, EPSILON) : raws);
+            raws.clear();
+            empty = false;
+            continue;
+        }
+        if (c == ')' || c == '}' || c == ']') {
+            error = "EBNF括号不匹配: " + line;
+            return false;
+        }
+        if (c == '*' || c == '?') {
+            error = string("EBNF运算符") + c + "前缺少符号: " + line;
+            return false;
+        }
+        size_t from = pos;
+        string symbol;
+        if (c == '(' || c == '{' || c == '[') {
+            char end = c == '(' ? ')' : c == '{' ? '}' : ']';
+            vector<vector<string> > group;
+            ++pos;
+            if (!parseEbnf(key, line, pos, end, group))
+                return false;
+            if (pos >= line.size()) {
+                error = "EBNF括号不匹配: " + line;
+                return false;
+            }
+            if (group.empty())
+                group.push_back(vector<string>(1, EPSILON));
+            string text = fragment(line, from, pos);
+            if (c == '(') {
+                // 分组：只有单个符号时不需要辅助符号
+                symbol = group.size() == 1 && group[0].size() == 1 ? group[0][0] : addHelper(key, text, group);
+            } else if (c == '{') {
+                symbol = addHelper(key, text, group, true);
+            } else {
+                // 可选：H->...|@
+                if (find(group.begin(), group.end(), vector<string>(1, EPSILON)) == group.end())
+                    group.push_back(vector<string>(1, EPSILON));
+                symbol = addHelper(key, text, group);
+            }
+        } else if (c == '\\' && pos + 1 < line.size()) {
+            // 转义：\后的字符按普通终结符号处理
+            symbol = string(1, line[++pos]);
+        } else {
+            symbol = string(1, c);
+        }
+        // 后缀运算符
+        for (size_t next = line.find_first_not_of(' ', pos + 1); next != string::npos && (line[next] == '*' || line[next] == '?');
+             next = line.find_first_not_of(' ', pos + 1)) {
+            pos = next;
+            if (symbol == EPSILON)
+                continue; // 空串的重复或可选仍是空串
+            vector<vector<string> > group{ { symbol } };
+            if (line[pos] == '?')
+                group.push_back(vector<string>(1, EPSILON));
+            symbol = addHelper(key, fragment(line, from, pos), group, line[pos] == '*');
+        }
+        // 空串(如空分组()、(@))不占位置，整条候选式为空时在下面补EPSILON
+        if (symbol != EPSILON)
+            raws.push_back(symbol);
+    }
+    if (!empty || !raws.empty())
+        alternatives.push_back(raws.empty() ? vector<string>(1, EPSILON) : raws);
+    return true;
+}
+
+string Grammer::addHelper(const string& key, const string& text, const vector<vector<string> >& alternatives, bool repeat) {
+    // 名称含多个字符，不会与单字符的文法符号冲突
+    string name = key + "~" + to_string(helpers.size() + 1);
+    helpers[name] = text;
+    vector<vector<string> >& productions = formula[name];
+    if (!repeat) {
+        productions = alternatives;
+        return name;
+    }
+    // 重复零次或多次：H->H...|@，左递归使分析栈不随重复次数增长
+    for (auto& raws : alternatives) {
+        if (raws.size() == 1 && raws[0] == EPSILON)
+            continue;
+        productions.push_back(vector<string>(1, name));
+        productions.back().insert(productions.back().end(), raws.begin(), raws.end());
+    }
+    productions.push_back(vector<string>(1, EPSILON));
+    return name;
+}
+
+bool Grammer::productionPrecedence(const Node& node, Precedence& prec) const {
+    const vector<string>& raws = getProductions(node.key)[node.rawsIndex];
+    for (auto it = raws.rbegin(); it != raws.rend(); ++it) {
+        auto found = precedence.find(*it);
+        if (found != precedence.end()) {
+            prec = found->second;
+            return true;
+        }
+    }
+    return false;
+}
+
+string Grammer::productionText(const Node& node) const {
+    string text = node.key + "->";
+    for (auto& token : getProductions(node.key)[node.rawsIndex]) {
+        text += token;
+    }
+    return text;
+}
+
 void Grammer::initIsSLR() {
     // DFA图构建完成后 -> 判断移进规约是否冲突
     if (isSLR) {
@@ -325,7 +724,38 @@ void Grammer::initIsSLR() {
             set_intersection(curForwards.begin(), curForwards.end(),
                              curBackwards.begin(), curBackwards.end(),
                              inserter(duplicates, duplicates.begin()));
-            if (!duplicates.empty()) {
+            bool conflict = false;
+            for (auto& token : duplicates) {
+                // 按优先级和结合性消解移进规约冲突
+                const Node& item = dfa[cur][backwards[cur][token]];
+                auto tokenPrec = precedence.find(token);
+                Precedence rulePrec;
+                if (tokenPrec == precedence.end() || !productionPrecedence(item, rulePrec)) {
+                    conflict = true; // 未声明优先级，无法消解
+                    continue;
+                }
+                ss.str("");
+                ss.clear();
+                ss << "第" << cur << "个节点输入" << token << "时";
+                if (rulePrec.level > tokenPrec->second.level ||
+                    (rulePrec.level == tokenPrec->second.level && rulePrec.assoc == LEFT_ASSOC)) {
+                    // 推导式优先级更高或左结合 -> 规约
+                    forwards[cur].erase(token);
+                    ss << "按" << productionText(item) << "规约";
+                } else if (rulePrec.level < tokenPrec->second.level || rulePrec.assoc == RIGHT_ASSOC) {
+                    // 输入优先级更高或右结合 -> 移进
+                    backwards[cur].erase(token);
+                    ss << "移进，不按" << productionText(item) << "规约";
+                } else {
+                    // 不可结合 -> 出错
+                    forwards[cur].erase(token);
+                    backwards[cur].erase(token);
+                    explicitErrors.insert(cur);
+                    ss << "报错(" << token << "不可结合)";
+                }
+                resolutions.push_back(ss.str());
+            }
+            if (conflict) {
                 // 交集不空 不为SLR
                 isSLR = false;
                 ss.str("");
@@ -338,6 +768,63 @@ void Grammer::initIsSLR() {
     }
 }
 
+bool Grammer::isUnit(const Node& node) const {
+    const vector<string>& raws = getProductions(node.key)[node.rawsIndex];
+    return raws.size() == 1 && notEnd.count(raws[0]);
+}
+
+void Grammer::initUnitJumps() {
+    // 对每一条GOTO(from, key) = to，检查to在各输入下是否立即执行单产生式规约
+    for (auto& p : forwards) {
+        int from = p.first;
+        for (auto& edge : p.second) {
+            if (!notEnd.count(edge.first))
+                continue; // 只处理非终结符号的GOTO
+            int to = edge.second;
+            if (!backwards.count(to))
+                continue;
+            for (auto& reduce : backwards[to]) {
+                string token = reduce.first;
+                UnitJump jump{to, {}};
+                // 沿单产生式链前进，步数不超过非终结符号个数，避免A->B、B->A成环
+                for (int steps = 0; steps < (int)notEnd.size(); ++steps) {
+                    int state = jump.target;
+                    if (forwards[state].count(token) || !backwards[state].count(token))
+                        break; // 优先移进，或没有规约
+                    int index = backwards[state][token];
+                    Node& item = dfa[state][index];
+                    if (item.key == start || !isUnit(item))
+                        break; // 接收项或非单产生式
+                    if (!forwards[from].count(item.key))
+                        break;
+                    jump.skipped.push_back(make_pair(state, index));
+                    jump.target = forwards[from][item.key];
+                }
+                if (jump.skipped.empty())
+                    continue;
+                charge(memory.indexes, ENTRY_BYTES + sizeof(UnitJump) + jump.skipped.size() * sizeof(pair<int, int>));
+                unitJumps[from][edge.first][token] = jump;
+            }
+        }
+    }
+}
+
+int Grammer::unitJump(int state, int symbol, int token) const {
+    if (jumpTable.empty()) return -1;
+    int row = jumpRows.get(state, symbol);
+    return row < 0 ? -1 : jumpTable.get(row, token);
+}
+
+const UnitJump* Grammer::findUnitJump(int state, const string& key, const string& token) const {
+    auto byState = unitJumps.find(state);
+    if (byState == unitJumps.end()) return nullptr;
+    auto byKey = byState->second.find(key);
+    if (byKey == byState->second.end()) return nullptr;
+    auto jump = byKey->second.find(token);
+    if (jump == byKey->second.end()) return nullptr;
+    return &jump->second;
+}
+
 int Grammer::findState(vector<Node>& current) {
     for (int i = 0; i < dfa.size(); ++i) {
         auto& state = dfa[i];
@@ -354,19 +841,246 @@ int Grammer::findState(vector<Node>& current) {
     return -1;
 }
 
-bool Grammer::slr() { return isSLR; }
-bool Grammer::bad() { return !error.empty(); }
-string Grammer::getReason() { return reason; }
-string Grammer::getError() { return error; }
+void Grammer::initDefaultReduces() {
+    defaultReduces.assign(dfa.size(), -1);
+    for (int cur = 0; cur < (int)dfa.size(); ++cur) {
+        if (!backwards.count(cur) || backwards[cur].empty() || explicitErrors.count(cur))
+            continue;
+        // 所有输入都规约到同一个项目
+        int target = backwards[cur].begin()->second;
+        bool single = true;
+        for (auto& p : backwards[cur]) {
+            if (p.second != target)
+                single = false;
+        }
+        // 接收项目必须看到END_FLAG
+        if (!single || dfa[cur][target].key == start)
+            continue;
+        // 不能有终结符号的移进
+        bool shift = false;
+        for (auto& p : forwards[cur]) {
+            if (!notEnd.count(p.first))
+                shift = true;
+        }
+        if (shift)
+            continue;
+        defaultReduces[cur] = target;
+        // 压缩：去掉逐个输入的规约关系
+        charge(memory.backwards, -(long long)backwards[cur].size() * ENTRY_BYTES);
+        backwards.erase(cur);
+    }
+}
+
+void PackedTable::build(const vector<vector<pair<int, int> > >& rows) {
+    base.assign(rows.size(), 0);
+    check.clear();
+    values.clear();
+    // 先放项多的行，每行放在不与已有项重叠的最小偏移处
+    vector<int> order(rows.size());
+    for (int row = 0; row < (int)rows.size(); ++row) {
+        order[row] = row;
+    }
+    stable_sort(order.begin(), order.end(), [&](int a, int b) { return rows[a].size() > rows[b].size(); });
+    size_t free = 0; // 第一个空位
+    for (int row : order) {
+        const vector<pair<int, int> >& entries = rows[row];
+        if (entries.empty())
+            continue; // 空行的偏移任意，check中不会出现该行
+        size_t offset = free > (size_t)entries[0].first ? free - entries[0].first : 0;
+        for (;; ++offset) {
+            bool fits = true;
+            for (auto& entry : entries) {
+                size_t i = offset + entry.first;
+                if (i < check.size() && check[i] != -1) {
+                    fits = false;
+                    break;
+                }
+            }
+            if (fits)
+                break;
+        }
+        size_t end = offset + entries.back().first + 1;
+        if (end > check.size()) {
+            check.resize(end, -1);
+            values.resize(end, -1);
+        }
+        for (auto& entry : entries) {
+            check[offset + entry.first] = row;
+            values[offset + entry.first] = entry.second;
+        }
+        base[row] = offset;
+        while (free < check.size() && check[free] != -1)
+            ++free;
+    }
+    check.shrink_to_fit();
+    values.shrink_to_fit();
+}
+
+size_t PackedTable::bytes() const { return (base.capacity() + check.capacity() + values.capacity()) * sizeof(int); }
 
-set<string> Grammer::getNotEnd() { return notEnd; }
-set<string> Grammer::getEnd() { return endSet; }
+void PackedTable::clear() {
+    vector<int>().swap(base);
+    vector<int>().swap(check);
+    vector<int>().swap(values);
+}
 
-string Grammer::getStart() {
+void Grammer::initTables() {
+    // 符号编号：终结符号(含END_FLAG)在前，非终结符号在后
+    for (auto& token : endSet) {
+        symbols.push_back(token);
+    }
+    if (!endSet.count(END_FLAG))
+        symbols.push_back(END_FLAG);
+    terminals = symbols.size();
+    for (auto& token : notEnd) {
+        symbols.push_back(token);
+    }
+    charSymbols.assign(256, -1);
+    for (int id = 0; id < (int)symbols.size(); ++id) {
+        symbolIds[symbols[id]] = id;
+        if (symbols[id].size() == 1)
+            charSymbols[(unsigned char)symbols[id][0]] = id;
+    }
+    endSymbol = symbolIds[END_FLAG];
+    // 压缩的分析表，只保存有关系的项，默认规约状态不保存逐个输入的规约关系
+    vector<vector<pair<int, int> > > rows(dfa.size());
+    for (auto& p : forwards) {
+        for (auto& edge : p.second) {
+            rows[p.first].push_back(make_pair(symbolIds[edge.first], edge.second));
+        }
+    }
+    for (auto& row : rows) {
+        sort(row.begin(), row.end());
+    }
+    forwardTable.build(rows);
+    rows.assign(dfa.size(), vector<pair<int, int> >());
+    for (auto& p : backwards) {
+        for (auto& edge : p.second) {
+            auto id = symbolIds.find(edge.first);
+            if (id != symbolIds.end() && id->second < terminals)
+                rows[p.first].push_back(make_pair(id->second, edge.second));
+        }
+    }
+    for (auto& row : rows) {
+        sort(row.begin(), row.end());
+    }
+    backwardTable.build(rows);
+    // 单产生式跳转：每条(状态, 非终结符号)占一行，按输入查跳转到的状态
+    rows.assign(dfa.size(), vector<pair<int, int> >());
+    vector<vector<pair<int, int> > > jumps;
+    for (auto& byState : unitJumps) {
+        for (auto& byKey : byState.second) {
+            rows[byState.first].push_back(make_pair(symbolIds[byKey.first], jumps.size()));
+            jumps.push_back(vector<pair<int, int> >());
+            for (auto& jump : byKey.second) {
+                jumps.back().push_back(make_pair(symbolIds[jump.first], jump.second.target));
+            }
+            sort(jumps.back().begin(), jumps.back().end());
+        }
+    }
+    for (auto& row : rows) {
+        sort(row.begin(), row.end());
+    }
+    jumpRows.build(rows);
+    jumpTable.build(jumps);
+    // 栈底以下状态未知时的GOTO：每个状态只有一个接入符号，q下面的状态只能是q的前驱之一
+    vector<vector<int> > predecessors(dfa.size());
+    for (auto& p : forwards) {
+        for (auto& edge : p.second) {
+            predecessors[edge.second].push_back(p.first);
+        }
+    }
+    rows.assign(dfa.size(), vector<pair<int, int> >());
+    for (int cur = 0; cur < (int)dfa.size(); ++cur) {
+        if (predecessors[cur].empty())
+            continue;
+        for (int symbol = terminals; symbol < (int)symbols.size(); ++symbol) {
+            int target = forwardTable.get(predecessors[cur][0], symbol);
+            for (size_t i = 1; i < predecessors[cur].size() && target >= 0; ++i) {
+                if (forwardTable.get(predecessors[cur][i], symbol) != target)
+                    target = -1;
+            }
+            if (target >= 0)
+                rows[cur].push_back(make_pair(symbol, target));
+        }
+    }
+    baseGotos.build(rows);
+    if (!charge(memory.tables, forwardTable.bytes() + backwardTable.bytes() + jumpRows.bytes() + jumpTable.bytes()
+                + baseGotos.bytes())) {
+        stringstream ss;
+        ss << "分析表需要" << memory.tables << "字节，合计超过内存上限" << options.maxMemory << "字节";
+        giveUp(ss.str());
+        return;
+    }
+    // 推导式编号，按非终结符号顺序连续编号
+    for (auto& p : formula) {
+        productionOffsets[p.first] = productions.size();
+        for (int j = 0; j < (int)p.second.size(); ++j) {
+            int length = 0;
+            for (auto& token : p.second[j]) {
+                if (token != EPSILON) length++;
+            }
+            productions.push_back(Production{p.first, j, symbolIds[p.first], length});
+        }
+    }
+    acceptProduction = productionOffsets[start];
+    enterStates.resize(symbols.size());
+    for (auto& p : forwards) {
+        for (auto& edge : p.second) {
+            vector<int>& states = enterStates[symbolIds[edge.first]];
+            if (!count(states.begin(), states.end(), edge.second))
+                states.push_back(edge.second);
+        }
+    }
+    itemProductions.resize(dfa.size());
+    for (int cur = 0; cur < (int)dfa.size(); ++cur) {
+        for (auto& item : dfa[cur]) {
+            itemProductions[cur].push_back(productionOffsets[item.key] + item.rawsIndex);
+        }
+    }
+    // 各索引的占用
+    long long bytes = (symbolIds.size() + productionOffsets.size()) * ENTRY_BYTES + charSymbols.size() * sizeof(int)
+                      + productions.size() * sizeof(Production) + (enterStates.size() + itemProductions.size()) * sizeof(vector<int>);
+    for (auto& states : enterStates) {
+        bytes += states.size() * sizeof(int);
+    }
+    for (auto& items : itemProductions) {
+        bytes += items.size() * sizeof(int);
+    }
+    charge(memory.indexes, bytes);
+    overBudget();
+}
+
+bool Grammer::slr() const { return isSLR; }
+bool Grammer::bad() const { return !error.empty(); }
+const string& Grammer::getReason() const { return reason; }
+const string& Grammer::getError() const { return error; }
+const vector<string>& Grammer::getResolutions() const { return resolutions; }
+const vector<string>& Grammer::getWarnings() const { return warnings; }
+bool Grammer::isHelper(const string& symbol) const { return helpers.count(symbol) > 0; }
+const MemoryUsage& Grammer::getMemoryUsage() const { return memory; }
+
+const set<string>& Grammer::getNotEnd() const { return notEnd; }
+const set<string>& Grammer::getEnd() const { return endSet; }
+
+const string& Grammer::getStart() const {
     return start;
 }
 
-string Grammer::getExtraGrammer() {
+int Grammer::symbolId(const string& token) const {
+    auto it = symbolIds.find(token);
+    return it == symbolIds.end() ? -1 : it->second;
+}
+
+int Grammer::symbolId(char token) const {
+    return charSymbols.empty() ? -1 : charSymbols[(unsigned char)token];
+}
+
+const string& Grammer::symbolName(int id) const { return symbols[id]; }
+int Grammer::symbolCount() const { return symbols.size(); }
+int Grammer::terminalCount() const { return terminals; }
+
+string Grammer::getExtraGrammer() const {
     stringstream ss;
     map<string, bool> visited;
     queue<string> ready;
@@ -377,8 +1091,7 @@ string Grammer::getExtraGrammer() {
         if (visited[cur])
             continue;
         visited[cur] = true;
-        vector<vector<string>> rawsOfCur = formula[cur];
-        for (auto &raw : rawsOfCur) {
+        for (auto &raw : getProductions(cur)) {
             ss << cur << " -> ";
             for (auto &token : raw) {
                 if (notEnd.count(token)) {
@@ -392,33 +1105,92 @@ string Grammer::getExtraGrammer() {
     return ss.str();
 }
 
-vector<vector<Node>> Grammer::getDfa() { return dfa; }
+const vector<vector<Node>>& Grammer::getDfa() const { return dfa; }
 
-map<string, vector<vector<string>>> Grammer::getFormula() {
+const vector<Node>& Grammer::getState(int state) const { return dfa[state]; }
+
+int Grammer::stateCount() const { return dfa.size(); }
+
+const map<string, vector<vector<string>>>& Grammer::getFormula() const {
     return formula;
 }
 
-int Grammer::forward(int state, string key) {
-    if (forwards[state].count(key)) {
-        return forwards[state][key];
+const vector<vector<string>>& Grammer::getProductions(const string& key) const {
+    static const vector<vector<string>> none;
+    auto it = formula.find(key);
+    return it == formula.end() ? none : it->second;
+}
+
+int Grammer::forward(int state, const string& key) const {
+    auto byState = forwards.find(state);
+    if (byState == forwards.end()) return -1;
+    auto it = byState->second.find(key);
+    return it == byState->second.end() ? -1 : it->second;
+}
+
+int Grammer::backward(int state, const string& key) const {
+    if (defaultReduce(state) >= 0) {
+        int id = symbolId(key);
+        return id >= 0 && id < terminals ? defaultReduces[state] : -1;
     }
-    return -1;
+    auto byState = backwards.find(state);
+    if (byState == backwards.end()) return -1;
+    auto it = byState->second.find(key);
+    return it == byState->second.end() ? -1 : it->second;
+}
+
+int Grammer::forward(int state, int symbol) const {
+    if (symbol < 0) return -1;
+    return forwardTable.get(state, symbol);
+}
+
+int Grammer::backward(int state, int symbol) const {
+    if (symbol < 0 || symbol >= terminals) return -1;
+    if (defaultReduce(state) >= 0) return defaultReduces[state];
+    return backwardTable.get(state, symbol);
+}
+
+int Grammer::productionCount() const { return productions.size(); }
+
+int Grammer::productionId(const string& key, int rawsIndex) const {
+    auto it = productionOffsets.find(key);
+    if (it == productionOffsets.end() || rawsIndex < 0 || rawsIndex >= (int)getProductions(key).size())
+        return -1;
+    return it->second + rawsIndex;
+}
+
+int Grammer::productionId(int state, int item) const { return itemProductions[state][item]; }
+
+const Production& Grammer::getProduction(int id) const { return productions[id]; }
+
+int Grammer::defaultReduce(int state) const {
+    if (defaultReduces.empty()) return -1;
+    return defaultReduces[state];
 }
 
-int Grammer::backward(int state, string key) {
-    if (backwards[state].count(key)) {
-        return backwards[state][key];
+// 符号栈的显示文本
+static string stackText(const vector<vector<string> >& stack) {
+    string text;
+    for (auto& slot : stack) {
+        for (auto& symbol : slot) {
+            text += symbol;
+        }
     }
-    return -1;
+    return text;
 }
 
-ParsedResult Grammer::parse(string input) {
+ParsedResult Grammer::parse(string input, ParseProfile* profile) const {
     string str;
     for (auto& s : input) {
         if (s != ' ' && s != '\n') str += s;
     }
     ParsedResult result;
-    string output;
+    if (bad() || dfa.empty()) {
+        // 文法构建失败，没有可用的分析表
+        result.error = getError();
+        return result;
+    }
+    vector<vector<string> > output; // 符号栈，辅助非终结符号展开为其子符号
     queue<string> inputs;
     vector<int> stash;
 
@@ -429,66 +1201,585 @@ ParsedResult Grammer::parse(string input) {
     int state = 0; // 当前DFA状态编号
     int count = 0;
     stringstream ss;
+    if (profile) {
+        // 统计表按当前文法扩容，已有数据保留
+        profile->runs++;
+        if (profile->shifts.size() < dfa.size()) {
+            profile->shifts.resize(dfa.size());
+            profile->reduces.resize(dfa.size());
+            profile->errors.resize(dfa.size());
+        }
+        if (profile->productions.size() < productions.size())
+            profile->productions.resize(productions.size());
+    }
     for (;;) {
         ss.str("");
         ss.clear();
-        map<string, int>& curForwards = forwards[state]; // 当前所有可移进状态
-        map<string, int>& curBackwards = backwards[state]; // 当前所有可规约状态
-
         string token = inputs.front(); // 当前输入的字符
         stash.push_back(state); // 当前状态入栈
 
-        if (curForwards.count(token)) {
+        int target = defaultReduce(state); // 规约项目，默认规约不查输入
+        int next = target >= 0 ? -1 : forward(state, token); // 移进到的下一个状态
+        if (target < 0 && next < 0)
+            target = backward(state, token);
+        if (next >= 0) {
             // 找到了移进关系
+            if (profile) profile->shifts[state]++;
             inputs.pop();
             ++count;
-            int next = curForwards[token]; // 下一个状态
             ss << "在状态" << state << "通过" << token << "移进到状态" << next;
             state = next;
-            output += token;
-            result.outputs.push_back(output);
+            output.push_back(vector<string>(1, token));
+            result.outputs.push_back(stackText(output));
             result.routes.push_back(ss.str());
             result.inputs.push_back(str.substr(count));
             continue;
         }
-        if (curBackwards.count(token)) {
+        if (target >= 0) {
             // 找到了规约关系
-            int target = curBackwards[token];
-            ss << "在状态" << state << "通过" << token << "规约到状态" << target;
-            Node& node = dfa[state][target];
-            if (count >= str.size()) {
-                result.inputs.push_back("");
+            if (profile) {
+                profile->reduces[state]++;
+                profile->productions[itemProductions[state][target]]++;
             }
-            else {
-                result.inputs.push_back(str.substr(count));
+            ss << "在状态" << state << "通过" << token << "规约到状态" << target;
+            const Node& node = dfa[state][target];
+            string rest = count >= str.size() ? "" : str.substr(count);
+            bool visible = !isHelper(node.key); // 辅助非终结符号的规约不记入分析过程
+            if (visible) {
+                result.inputs.push_back(rest);
+                result.routes.push_back(ss.str());
             }
-            result.routes.push_back(ss.str());
             if (node.key == start) {
                 // 接收
                 result.accept = true;
                 result.outputs.push_back(start);
                 break;
             }
-            vector<string>& raws = formula[node.key][node.rawsIndex];
+            const vector<string>& raws = getProductions(node.key)[node.rawsIndex];
             int useful = 0;
             for (int i = 0; i < raws.size(); ++i) {
                 // 找到不是EPSILON的大小
                 if (raws[i] != EPSILON) useful++;
             }
+            vector<string> children; // 被规约的符号，辅助非终结符号规约后仍然显示它们
+            for (size_t i = output.size() - useful; i < output.size(); ++i) {
+                children.insert(children.end(), output[i].begin(), output[i].end());
+            }
             if (useful > 0) {
-                output.erase(output.end() - useful, output.end());
+                output.resize(output.size() - useful);
                 stash.erase(stash.end() - useful, stash.end());
             }
-            int next = forwards[stash[stash.size() - 1]][node.key];
+            string symbol = node.key;
+            vector<string> shown = isHelper(symbol) ? children : vector<string>(1, symbol);
+            next = forward(stash[stash.size() - 1], symbol);
+            const UnitJump* jump = options.eliminateUnit ? findUnitJump(stash[stash.size() - 1], symbol, token) : nullptr;
+            if (jump) {
+                // 单产生式已在表中消除，直接跳到链的终点
+                for (auto& step : jump->skipped) {
+                    const Node& unit = dfa[step.first][step.second];
+                    if (profile) {
+                        profile->reduces[step.first]++;
+                        profile->productions[itemProductions[step.first][step.second]]++;
+                    }
+                    if (!options.collapseUnit) {
+                        // 补记被跳过的单产生式规约
+                        if (visible) {
+                            output.push_back(shown);
+                            result.outputs.push_back(stackText(output));
+                            output.pop_back();
+                        }
+                        visible = !isHelper(unit.key);
+                        if (visible) {
+                            ss.str("");
+                            ss.clear();
+                            ss << "在状态" << step.first << "通过" << token << "规约到状态" << step.second << "(单产生式)";
+                            result.inputs.push_back(rest);
+                            result.routes.push_back(ss.str());
+                        }
+                    }
+                    symbol = unit.key;
+                    if (!isHelper(symbol))
+                        shown.assign(1, symbol);
+                }
+                next = jump->target;
+            }
             state = next;
-            output += node.key;
-            result.outputs.push_back(output);
+            output.push_back(shown);
+            if (visible)
+                result.outputs.push_back(stackText(output));
             continue;
         }
         // 找不到关系，出错
+        if (profile) profile->errors[state]++;
         ss << "在状态" << state << "上找不到" << token << "对应的移进/规约关系";
             result.error = ss.str();
         break;
     }
     return result;
 }
+
+Grammer::RunStatus Grammer::run(vector<int>& stack, const string& text, size_t& pos, size_t end, size_t floor, int& blocked) const {
+    // text已去除空白，pos到达text末尾时输入为END_FLAG
+    // 栈底floor个状态不可弹出，需要弹出时返回RUN_BLOCKED，blocked为待规约的推导式编号
+    for (;;) {
+        if (pos == end)
+            return RUN_SHIFTED;
+        int state = stack.back();
+        int token = pos < text.size() ? charSymbols[(unsigned char)text[pos]] : endSymbol;
+        int item = defaultReduce(state); // 默认规约不查输入
+        int next = item >= 0 ? -1 : forward(state, token);
+        if (next >= 0) {
+            // 移进
+            stack.push_back(next);
+            ++pos;
+            continue;
+        }
+        if (item < 0)
+            item = backward(state, token);
+        if (item < 0)
+            return RUN_ERROR;
+        int id = itemProductions[state][item];
+        if (id == acceptProduction)
+            return RUN_ACCEPT;
+        const Production& production = productions[id];
+        if (floor == 1 && stack.size() == (size_t)production.length) {
+            // 正好弹出栈底：栈底下面的状态虽然未知，但GOTO结果可能与它无关
+            next = baseGotos.get(stack[0], production.symbol);
+            if (next >= 0) {
+                stack.assign(1, next);
+                continue;
+            }
+        }
+        if (stack.size() < floor + production.length) {
+            // 需要栈底以下的未知状态
+            blocked = id;
+            return RUN_BLOCKED;
+        }
+        stack.erase(stack.end() - production.length, stack.end());
+        next = forward(stack.back(), production.symbol);
+        if (next < 0)
+            return RUN_ERROR;
+        // 单产生式链已在表中消除，按当前输入直接跳到链的终点
+        int jump = unitJump(stack.back(), production.symbol, token);
+        stack.push_back(jump >= 0 ? jump : next);
+    }
+}
+
+string Grammer::runError(const vector<int>& stack, const string& text, size_t pos) const {
+    stringstream ss;
+    ss << "在状态" << stack.back() << "上找不到" << (pos < text.size() ? string(1, text[pos]) : string(END_FLAG))
+       << "对应的移进/规约关系";
+    return ss.str();
+}
+
+// 去除输入中的空白
+static string compact(const string& input) {
+    string text;
+    text.reserve(input.size());
+    for (char c : input) {
+        if (c != ' ' && c != '\n') text += c;
+    }
+    return text;
+}
+
+bool Grammer::accepts(const string& input, string* error) const {
+    if (bad() || dfa.empty()) {
+        if (error) *error = getError();
+        return false;
+    }
+    string text = compact(input);
+    vector<int> stack(1, 0);
+    size_t pos = 0;
+    int blocked;
+    RunStatus status = run(stack, text, pos, text.size() + 1, 0, blocked);
+    if (status != RUN_ACCEPT && error)
+        *error = runError(stack, text, pos);
+    return status == RUN_ACCEPT;
+}
+
+bool Grammer::acceptsParallel(const string& input, int threads, string* error) const {
+    // 每片至少的字符数，过小的输入直接顺序分析
+    static const size_t minChunk = 1 << 16;
+    // 每片最多的起始状态数，过多则该片直接顺序分析
+    static const size_t maxCandidates = 16;
+    // 每片跨越栈底的规约次数上限为片长的1/blockRatio，超出后该片剩余部分在拼接时顺序分析
+    static const size_t blockRatio = 64;
+
+    if (threads <= 0)
+        threads = max(1u, thread::hardware_concurrency());
+    string text = compact(input);
+    size_t chunks = min((size_t)threads, text.size() / minChunk);
+    if (bad() || dfa.empty() || chunks < 2)
+        return accepts(text, error);
+
+    // 推测分析的一个分支：从栈底base、位置from开始分析，栈底以下未知
+    // 规约需要弹出栈底时，按规约后可能到达的每个状态分叉继续，相同(状态, 位置)的分支共用
+    struct Speculation {
+        int base; // 栈底状态
+        RunStatus status;
+        size_t from; // 起始位置
+        size_t pos; // 停止位置
+        int drop; // RUN_BLOCKED：需从真实栈弹出的状态数(含栈底)
+        int symbol; // RUN_BLOCKED：规约到的符号，-1表示超出预算未分析
+        int sibling; // 同一起始位置的下一个分支，-1表示无
+        int bottom; // 未阻塞：停止时的栈底(可能已被替换)
+        int segment; // 未阻塞：停止时栈底之上的状态在segments中的编号，-1表示为空
+    };
+    vector<size_t> bounds(chunks + 1);
+    for (size_t i = 0; i < chunks; ++i) {
+        bounds[i] = text.size() / chunks * i;
+    }
+    bounds[chunks] = text.size() + 1; // 最后一片包含END_FLAG
+    vector<vector<Speculation> > speculations(chunks);
+    vector<vector<int> > heads(chunks); // 每片：起始位置 -> 第一个分支，-1表示无
+    vector<vector<vector<int> > > segments(chunks); // 每片：未阻塞的分支停止时栈底之上的状态，栈底之上相同的分支共用
+    for (size_t i = 0; i < chunks; ++i) {
+        heads[i].assign(bounds[i + 1] - bounds[i], -1);
+    }
+    // 状态state在位置pos的输入上是否有动作
+    auto active = [&](int state, size_t pos) {
+        int token = pos < text.size() ? charSymbols[(unsigned char)text[pos]] : endSymbol;
+        return defaultReduce(state) >= 0 || forward(state, token) >= 0 || backward(state, token) >= 0;
+    };
+    // 查找片chunk中栈底为state、从pos开始的分支，不存在返回-1
+    auto find = [&](size_t chunk, int state, size_t pos) {
+        int id = heads[chunk][pos - bounds[chunk]];
+        while (id >= 0 && speculations[chunk][id].base != state)
+            id = speculations[chunk][id].sibling;
+        return id;
+    };
+    // 加入一个分支，已存在则不重复加入并返回-1
+    auto spawn = [&](size_t chunk, int state, size_t pos) {
+        if (find(chunk, state, pos) >= 0)
+            return -1;
+        int& head = heads[chunk][pos - bounds[chunk]];
+        speculations[chunk].push_back(Speculation{state, RUN_BLOCKED, pos, pos, 0, -1, head, state, -1});
+        head = speculations[chunk].size() - 1;
+        return head;
+    };
+
+    // 一组待分析的分支：位置相同、栈底之上的状态upper相同，只有栈底不同
+    // 栈底也相同的分支此后的分析完全相同，归为一类
+    struct Group {
+        vector<int> upper;
+        vector<pair<int, int> > members; // (类编号, 当前栈底)
+    };
+    vector<vector<vector<int> > > classes(chunks); // 每片：类 -> 分支编号
+    vector<map<size_t, vector<Group> > > waves(chunks); // 每片：位置 -> 停在该位置待分析的组
+    for (size_t i = 0; i < chunks; ++i) {
+        vector<int> candidates;
+        if (i == 0) {
+            candidates.push_back(0);
+        } else {
+            // 起始状态：移进上一片最后一个符号后到达、且对本片第一个符号有动作的状态
+            int last = charSymbols[(unsigned char)text[bounds[i] - 1]];
+            if (last < 0 || last >= terminals)
+                continue;
+            for (int state : enterStates[last]) {
+                if (active(state, bounds[i]))
+                    candidates.push_back(state);
+            }
+            if (candidates.size() > maxCandidates)
+                continue;
+        }
+        for (int state : candidates) {
+            classes[i].push_back(vector<int>(1, spawn(i, state, bounds[i])));
+            waves[i][bounds[i]].push_back(Group{vector<int>(), {{(int)classes[i].size() - 1, state}}});
+        }
+    }
+
+    // 各线程分别推测分析一片
+    // 栈底之上相同的分支后续动作也相同，合为一组分析，规约弹到栈底时才按各自的栈底分开
+    // 各组按位置从小到大推进，到达同一位置、栈底之上相同的组随即合并
+    vector<thread> workers;
+    for (size_t w = 0; w < chunks; ++w) {
+        workers.emplace_back([&, w]() {
+            vector<Speculation>& branches = speculations[w];
+            vector<vector<int> >& sets = classes[w];
+            map<size_t, vector<Group> >& pending = waves[w];
+            size_t end = bounds[w + 1];
+            size_t budget = (end - bounds[w]) / blockRatio;
+            size_t blocks = 0;
+            vector<int> stack;
+            auto finish = [&](int set, RunStatus status, size_t pos, int bottom, int segment) {
+                for (int id : sets[set]) {
+                    Speculation& branch = branches[id];
+                    branch.status = status;
+                    branch.pos = pos;
+                    branch.bottom = bottom;
+                    branch.segment = segment;
+                }
+            };
+            // 停止时栈底之上的状态，同组分支共用
+            auto save = [&]() {
+                segments[w].push_back(vector<int>(stack.begin() + 1, stack.end()));
+                return (int)segments[w].size() - 1;
+            };
+            // 需要弹出栈底以下的状态：记录后按规约后可能到达的状态分叉
+            auto block = [&](int set, size_t pos, int drop, int symbol) {
+                for (int id : sets[set]) {
+                    Speculation& branch = branches[id];
+                    branch.status = RUN_BLOCKED;
+                    branch.pos = pos;
+                    branch.drop = drop;
+                    branch.symbol = symbol;
+                }
+                ++blocks;
+                for (int state : enterStates[symbol]) {
+                    if (!active(state, pos))
+                        continue;
+                    int fork = spawn(w, state, pos);
+                    if (fork < 0)
+                        continue;
+                    sets.push_back(vector<int>(1, fork));
+                    pending[pos].push_back(Group{vector<int>(), {{(int)sets.size() - 1, state}}});
+                }
+            };
+            // 栈底相同的成员合为一类
+            auto unite = [&](vector<pair<int, int> >& members) {
+                if (members.size() < 2)
+                    return;
+                sort(members.begin(), members.end(), [](const pair<int, int>& a, const pair<int, int>& b) {
+                    return a.second < b.second;
+                });
+                size_t kept = 0;
+                for (size_t m = 0; m < members.size(); ++m) {
+                    if (kept > 0 && members[kept - 1].second == members[m].second) {
+                        vector<int>& into = sets[members[kept - 1].first];
+                        vector<int>& from = sets[members[m].first];
+                        into.insert(into.end(), from.begin(), from.end());
+                        from.clear();
+                        continue;
+                    }
+                    members[kept++] = members[m];
+                }
+                members.resize(kept);
+            };
+            // 栈底之上为空时动作取决于栈底，单独分析到移进下一个符号，仍需继续时返回true
+            auto step = [&](int set, int bottom, size_t& pos) {
+                stack.assign(1, bottom);
+                int blocked = -1;
+                RunStatus status = run(stack, text, pos, pos + 1, 1, blocked);
+                if (status == RUN_BLOCKED) {
+                    const Production& production = productions[blocked];
+                    block(set, pos, production.length - (stack.size() - 1), production.symbol);
+                    return false;
+                }
+                if (status != RUN_SHIFTED || pos == end) {
+                    finish(set, status, pos, stack[0], save());
+                    return false;
+                }
+                return true;
+            };
+            vector<pair<int, int> > members;
+            vector<Group> next; // 规约弹到栈底后各成员的去向
+            vector<size_t> nextPos;
+            while (!pending.empty() && blocks <= budget) {
+                size_t from = pending.begin()->first;
+                vector<Group> wave = move(pending.begin()->second);
+                pending.erase(pending.begin());
+                map<vector<int>, vector<pair<int, int> > > groups;
+                for (auto& group : wave) {
+                    if (!group.upper.empty()) {
+                        vector<pair<int, int> >& joined = groups[group.upper];
+                        joined.insert(joined.end(), group.members.begin(), group.members.end());
+                        continue;
+                    }
+                    for (auto& member : group.members) {
+                        size_t pos = from;
+                        if (step(member.first, member.second, pos))
+                            pending[pos].push_back(Group{vector<int>(stack.begin() + 1, stack.end()), {{member.first, stack[0]}}});
+                    }
+                }
+                for (auto& group : groups) {
+                    members.swap(group.second);
+                    unite(members);
+                    size_t pos = from;
+                    stack.assign(1, members[0].second);
+                    stack.insert(stack.end(), group.first.begin(), group.first.end());
+                    for (;;) {
+                        // 只分析到下一个有组等待的位置，以便在那里合并
+                        size_t stop = pending.empty() ? end : min(end, pending.begin()->first);
+                        // 只有一个成员时栈底已知，可以弹出栈底；多个成员时栈底不参与分析
+                        size_t floor = members.size() == 1 ? 1 : 2;
+                        stack[0] = members[0].second;
+                        int blocked = -1;
+                        RunStatus status = run(stack, text, pos, stop, floor, blocked);
+                        if (status == RUN_SHIFTED && pos < end) {
+                            if (floor == 1)
+                                members[0].second = stack[0];
+                            pending[pos].push_back(Group{vector<int>(stack.begin() + 1, stack.end()), members});
+                            break;
+                        }
+                        if (status != RUN_BLOCKED) {
+                            int segment = save();
+                            for (auto& member : members) {
+                                finish(member.first, status, pos, floor == 1 ? stack[0] : member.second, segment);
+                            }
+                            break;
+                        }
+                        const Production& production = productions[blocked];
+                        int above = stack.size() - 1; // 栈底之上的状态数
+                        if (floor == 1) {
+                            block(members[0].first, pos, production.length - above, production.symbol);
+                            break;
+                        }
+                        // 规约弹到栈底，按各自的栈底继续
+                        int token = pos < text.size() ? charSymbols[(unsigned char)text[pos]] : endSymbol;
+                        size_t count = 0;
+                        for (auto& member : members) {
+                            int bottom = member.second;
+                            size_t at = pos;
+                            if (production.length == above) {
+                                int goal = forward(bottom, production.symbol);
+                                if (goal < 0) {
+                                    finish(member.first, RUN_ERROR, pos, bottom, -1);
+                                    continue;
+                                }
+                                int jump = unitJump(bottom, production.symbol, token);
+                                stack.assign(1, bottom);
+                                stack.push_back(jump >= 0 ? jump : goal);
+                            } else {
+                                // 正好弹出栈底时可能换成新的栈底
+                                int goal = production.length == above + 1 ? baseGotos.get(bottom, production.symbol) : -1;
+                                if (goal < 0) {
+                                    block(member.first, pos, production.length - above, production.symbol);
+                                    continue;
+                                }
+                                if (!step(member.first, goal, at))
+                                    continue;
+                            }
+                            if (next.size() <= count) {
+                                next.resize(count + 1);
+                                nextPos.resize(count + 1);
+                            }
+                            next[count].upper.assign(stack.begin() + 1, stack.end());
+                            next[count].members.assign(1, make_pair(member.first, stack[0]));
+                            nextPos[count++] = at;
+                        }
+                        if (count == 0)
+                            break;
+                        bool same = true;
+                        for (size_t m = 1; m < count; ++m) {
+                            same = same && nextPos[m] == nextPos[0] && next[m].upper == next[0].upper;
+                        }
+                        if (!same || (!pending.empty() && pending.begin()->first <= nextPos[0])) {
+                            // 分开或遇到其他组，回到队列重新分组
+                            for (size_t m = 0; m < count; ++m) {
+                                pending[nextPos[m]].push_back(next[m]);
+                            }
+                            break;
+                        }
+                        // 仍然一致，原地继续
+                        members.clear();
+                        for (size_t m = 0; m < count; ++m) {
+                            members.push_back(next[m].members[0]);
+                        }
+                        unite(members);
+                        pos = nextPos[0];
+                        stack.assign(1, members[0].second);
+                        stack.insert(stack.end(), next[0].upper.begin(), next[0].upper.end());
+                    }
+                }
+            }
+        });
+    }
+    for (auto& worker : workers) {
+        worker.join();
+    }
+
+    // 从左到右拼接
+    vector<int> stack(1, 0);
+    size_t pos = 0;
+    for (size_t i = 0; i < chunks; ++i) {
+        int id = find(i, stack.back(), pos);
+        RunStatus status = RUN_BLOCKED;
+        while (id >= 0) {
+            // 栈顶与分支栈底吻合，分支的分析结果与顺序分析一致
+            const Speculation* branch = &speculations[i][id];
+            pos = branch->pos;
+            if (branch->status != RUN_BLOCKED) {
+                stack.back() = branch->bottom;
+                if (branch->segment >= 0) {
+                    const vector<int>& segment = segments[i][branch->segment];
+                    stack.insert(stack.end(), segment.begin(), segment.end());
+                }
+                status = branch->status;
+                break;
+            }
+            if (branch->symbol < 0)
+                break; // 超出预算未分析完
+            // 在真实栈上完成跨越栈底的规约
+            if ((int)stack.size() <= branch->drop) {
+                status = RUN_ERROR;
+                break;
+            }
+            stack.erase(stack.end() - branch->drop, stack.end());
+            int next = forward(stack.back(), branch->symbol);
+            if (next < 0) {
+                status = RUN_ERROR;
+                break;
+            }
+            stack.push_back(next);
+            id = pos < bounds[i + 1] ? find(i, next, pos) : -1;
+        }
+        if (status == RUN_BLOCKED) {
+            // 推测失败，顺序分析本片剩余部分
+            int blocked;
+            status = run(stack, text, pos, bounds[i + 1], 0, blocked);
+        }
+        if (status == RUN_ACCEPT)
+            return true;
+        if (status == RUN_ERROR) {
+            if (error) *error = runError(stack, text, pos);
+            return false;
+        }
+    }
+    if (error) *error = runError(stack, text, pos);
+    return false;
+}
+
+void ParseProfile::reset() {
+    shifts.clear();
+    reduces.clear();
+    productions.clear();
+    errors.clear();
+    runs = 0;
+}
+
+// 逐项累加，长度不足时扩容
+static void accumulate(vector<unsigned long long>& to, const vector<unsigned long long>& from) {
+    if (to.size() < from.size())
+        to.resize(from.size());
+    for (size_t i = 0; i < from.size(); ++i) {
+        to[i] += from[i];
+    }
+}
+
+void ParseProfile::merge(const ParseProfile& other) {
+    accumulate(shifts, other.shifts);
+    accumulate(reduces, other.reduces);
+    accumulate(productions, other.productions);
+    accumulate(errors, other.errors);
+    runs += other.runs;
+}
+
+string ParseProfile::toCsv(const Grammer& grammer) const {
+    stringstream ss;
+    ss << "kind,id,detail,count\n";
+    ss << "runs,,," << runs << '\n';
+    for (size_t state = 0; state < shifts.size(); ++state) {
+        ss << "shift," << state << ",," << shifts[state] << '\n';
+        ss << "reduce," << state << ",," << reduces[state] << '\n';
+        ss << "error," << state << ",," << errors[state] << '\n';
+    }
+    for (size_t id = 0; id < productions.size() && (int)id < grammer.productionCount(); ++id) {
+        const Production& production = grammer.getProduction(id);
+        ss << "production," << id << ",\"" << production.key << "->";
+        for (auto& token : grammer.getProductions(production.key)[production.rawsIndex]) {
+            ss << (token == "\"" ? "\"\"" : token);
+        }
+        ss << "\"," << productions[id] << '\n';
+    }
+    return ss.str();
+}
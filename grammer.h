@@ -1,3 +1,6 @@
+#ifndef GRAMMER_H
+#define GRAMMER_H
+
 #include <vector>
 #include <set>
 #include <map>
@@ -24,6 +27,86 @@ struct Node {
     }
 };
 
+// 推导式，按推导式编号索引
+struct Production {
+    std::string key; // 左部非终结符号
+    int rawsIndex; // 在key的推导式中的编号
+    int symbol; // 左部符号编号
+    int length; // 右部非EPSILON符号个数，即规约时弹栈个数
+};
+
+template <typename Value> struct SemanticActions;
+class Grammer;
+
+// 分析统计，传给parse()后在多次分析间累加，不传则不统计
+struct ParseProfile {
+    std::vector<unsigned long long> shifts; // 状态 -> 移进次数
+    std::vector<unsigned long long> reduces; // 状态 -> 规约次数
+    std::vector<unsigned long long> productions; // 推导式编号 -> 规约次数
+    std::vector<unsigned long long> errors; // 状态 -> 出错次数
+    unsigned long long runs = 0; // 分析次数
+
+    void reset(); // 清空统计
+    void merge(const ParseProfile&); // 累加另一份统计
+    std::string toCsv(const Grammer&) const; // 导出为CSV：类别,编号,说明,次数
+};
+
+// 结合性，对应%left/%right/%nonassoc声明
+enum Associativity {
+    LEFT_ASSOC,
+    RIGHT_ASSOC,
+    NON_ASSOC
+};
+
+// 终结符号的优先级，声明越靠后优先级越高
+struct Precedence {
+    int level;
+    Associativity assoc;
+};
+
+// 表构建选项
+struct GrammerOptions {
+    bool eliminateUnit = false; // 消除单产生式(A->B)规约，GOTO直接跳到单产生式链的终点(accepts等快速分析生效，evaluate仍逐个规约以执行语义动作)
+    bool collapseUnit = false; // 消除后parse不再在分析过程中记录被跳过的单产生式
+    bool defaultReduce = false; // 只有一个规约项目且不能移进的状态不查输入直接规约(出错会推迟到下一次移进前发现)
+    size_t maxStates = 0; // DFA节点个数上限，超出则放弃构建，0为不限
+    size_t maxMemory = 0; // 构建分析表的内存上限(字节)，超出则放弃构建，0为不限
+};
+
+// 构建分析表的内存占用，按各结构的元素个数估算(字节)
+struct MemoryUsage {
+    size_t dfa = 0; // DFA节点及其项目
+    size_t forwards = 0; // 移进关系
+    size_t backwards = 0; // 规约关系
+    size_t tables = 0; // 按编号索引的分析表
+    size_t indexes = 0; // 单产生式跳转、符号与推导式编号等索引
+    size_t current = 0; // 当前合计(含构建中的临时节点)
+    size_t peak = 0; // 峰值
+};
+
+// 单产生式跳转：GOTO到某非终结符号后，在当前输入下连续经过的单产生式规约
+struct UnitJump {
+    int target; // 最终到达的状态
+    std::vector<std::pair<int, int> > skipped; // 被跳过的规约(所在状态, 规约项目下标)
+};
+
+// 按行压缩的稀疏表：各行的非空项错开存放在同一数组中，check记录每一项所属的行
+struct PackedTable {
+    std::vector<int> base; // 行 -> 该行在values中的偏移
+    std::vector<int> check; // 项所属的行，-1表示空
+    std::vector<int> values;
+
+    void build(const std::vector<std::vector<std::pair<int, int> > >&); // 由每行按列升序的(列, 值)构建
+    size_t bytes() const;
+    bool empty() const { return base.empty(); }
+    void clear();
+    // 查表，不存在返回-1
+    int get(int row, int column) const {
+        size_t i = (size_t)base[row] + column;
+        return i < check.size() && check[i] == row ? values[i] : -1;
+    }
+};
+
 // 句子分析结果
 struct ParsedResult {
     std::vector<std::string> outputs;
@@ -34,47 +117,216 @@ struct ParsedResult {
     std::string error = ""; // 错误信息，空则无出错
 };
 
+// 文法及其SLR分析表
+// 所有表格在构造函数中生成，构造完成后不再修改：
+// const接口只读取已生成的表格，返回的引用在Grammer析构前一直有效，可在多线程间共享
 class Grammer {
 private:
     std::map<std::string, std::vector<std::vector<std::string> > > formula; // 分式
     std::string start; // 起始
-    std::map<std::string, std::set<std::string> > first; // FIRST集合元素
+    std::map<std::string, std::set<std::string> > first; // FIRST集合元素(终结符号的FIRST为其自身)
     std::map<std::string, std::set<std::string> > follow; // FOLLOW集合元素
     std::set<std::string> notEnd; // 非终结符号集合
     std::set<std::string> endSet; // 终结符号集合
     std::string error; // 是否有错误
     std::string reason; // 为什么不是SLR
+    std::vector<std::string> warnings; // 警告，如被删除的无用符号
     bool isSLR = false; // 是否SLR(1)
+    GrammerOptions options; // 表构建选项
+    MemoryUsage memory; // 内存占用
+    std::map<std::string, Precedence> precedence; // 终结符号优先级
+    std::vector<std::string> resolutions; // 按优先级消解的移进规约冲突
+    std::set<int> explicitErrors; // 因%nonassoc显式报错的状态
+    std::map<std::string, std::string> helpers; // EBNF展开生成的辅助非终结符号及其原文
 
     std::vector<std::vector<Node> > dfa; // DFA图
     std::map<int, std::map<std::string, int> > forwards; // 移进关系
     std::map<int, std::map<std::string, int> > backwards; // 规约关系
+    std::map<int, std::map<std::string, std::map<std::string, UnitJump> > > unitJumps; // 单产生式跳转表
+    std::vector<int> defaultReduces; // 状态 -> 默认规约项目下标，-1表示无
+
+    std::vector<std::string> symbols; // 符号编号 -> 符号，终结符号(含END_FLAG)在前
+    std::map<std::string, int> symbolIds; // 符号 -> 符号编号
+    std::vector<int> charSymbols; // 单字符符号 -> 符号编号，供逐字符分析使用
+    int terminals = 0; // 终结符号个数
+    int endSymbol = -1; // END_FLAG的编号
+    PackedTable forwardTable; // 按编号索引的移进关系 [状态][符号]
+    PackedTable backwardTable; // 按编号索引的规约关系 [状态][终结符号]，默认规约状态为空行
+    PackedTable baseGotos; // [状态q][非终结符号B] -> 所有能经q的接入符号到达q的状态x，GOTO(x, B)都相同时的结果
+    PackedTable jumpRows; // 单产生式跳转 [状态][非终结符号] -> jumpTable的行
+    PackedTable jumpTable; // 单产生式跳转 [行][终结符号] -> 跳转到的状态
+    std::vector<Production> productions; // 推导式编号 -> 推导式
+    std::map<std::string, int> productionOffsets; // 非终结符号 -> 其第一条推导式的编号
+    std::vector<std::vector<int> > itemProductions; // [状态][项目] -> 推导式编号
+    int acceptProduction = -1; // 拓广文法S'->S的编号
+    std::vector<std::vector<int> > enterStates; // 符号编号 -> 经该符号转移后可能到达的状态
 
+    // 分析片段的结果
+    enum RunStatus {
+        RUN_SHIFTED, // 片段内输入全部移进
+        RUN_BLOCKED, // 规约需要弹出栈底(推测分析失败)
+        RUN_ERROR, // 出错
+        RUN_ACCEPT // 接收
+    };
 
+    void reduceGrammer(); // 删除不可终止和不可达的非终结符号
+    bool charge(size_t&, long long); // 计入内存占用，超出预算返回false
+    bool overBudget(); // 是否超出状态数/内存上限，超出时放弃构建
+    void giveUp(const std::string&); // 放弃构建：记录出错信息并释放已构建的部分
     void initFirst(); // 生成First集合
     void initFollow(); // 生成Follow集合
     void extend(std::vector<Node>&); // 扩展DFA某节点的推导式
     void extend(int); // 扩展DFA某节点的推导式
     void initRelation(); // 生成DFA图、规约关系
     void initIsSLR(); // 初始化是否SLR(1)
+    void initUnitJumps(); // 生成单产生式跳转表
+    void initDefaultReduces(); // 标记默认规约状态并压缩其规约关系
+    void initTables(); // 生成按符号编号索引的分析表
+    bool parseDeclaration(const std::string&, int); // 解析%left/%right/%nonassoc声明
+    bool parseEbnf(const std::string& key, const std::string& line, size_t& pos, char close, std::vector<std::vector<std::string> >&); // 解析EBNF右部直到close
+    std::string addHelper(const std::string& key, const std::string& text, const std::vector<std::vector<std::string> >&, bool repeat = false); // 新增辅助非终结符号，repeat时展开为左递归的重复
+    bool productionPrecedence(const Node&, Precedence&) const; // 推导式的优先级(最后一个有优先级的终结符号)
+    std::string productionText(const Node&) const; // 推导式文本A->...
+    bool isUnit(const Node&) const; // 规约项目是否单产生式A->B
+    const UnitJump* findUnitJump(int, const std::string&, const std::string&) const; // 查找单产生式跳转
+    int unitJump(int, int, int) const; // 按编号查找单产生式跳转(状态, 非终结符号, 输入)，不存在返回-1
     int findState(std::vector<Node>&); // 是否包含此DFA节点
+    RunStatus run(std::vector<int>&, const std::string&, size_t&, size_t, size_t, int&) const; // 按编号表分析输入片段
+    std::string runError(const std::vector<int>&, const std::string&, size_t) const; // 出错信息
 public:
-    Grammer(std::string);
-
-    std::set<std::string> getFirst(std::string); // 获取节点的First集合
-    std::set<std::string> getFollow(std::string); // 获取节点的Follow集合
-    std::set<std::string> getNotEnd(); // 获取非终结符号集
-    std::set<std::string> getEnd(); // 获取终结符号集
-    std::string getExtraGrammer(); // 获取拓广文法
-    std::map<std::string, std::vector<std::vector<std::string> > > getFormula(); // 获取分式
-    bool slr();
-    bool bad();
-    std::string getReason();
-    std::string getError();
-    std::vector<std::vector<Node> > getDfa();
-    int forward(int, std::string);
-    int backward(int, std::string);
-    std::string getStart();
-
-    ParsedResult parse(std::string);
+    Grammer(std::string, GrammerOptions = GrammerOptions());
+
+    const std::set<std::string>& getFirst(const std::string&) const; // 获取节点的First集合
+    const std::set<std::string>& getFollow(const std::string&) const; // 获取节点的Follow集合
+    const std::set<std::string>& getNotEnd() const; // 获取非终结符号集
+    const std::set<std::string>& getEnd() const; // 获取终结符号集
+    std::string getExtraGrammer() const; // 获取拓广文法
+    const std::map<std::string, std::vector<std::vector<std::string> > >& getFormula() const; // 获取分式
+    const std::vector<std::vector<std::string> >& getProductions(const std::string&) const; // 获取某非终结符号的推导式
+    bool slr() const;
+    bool bad() const;
+    const std::string& getReason() const;
+    const std::string& getError() const;
+    const std::vector<std::string>& getResolutions() const; // 按优先级消解的冲突
+    const std::vector<std::string>& getWarnings() const; // 警告
+    bool isHelper(const std::string&) const; // 是否EBNF展开生成的辅助非终结符号
+    const MemoryUsage& getMemoryUsage() const; // 内存占用
+    const std::vector<std::vector<Node> >& getDfa() const;
+    const std::vector<Node>& getState(int) const; // 获取DFA某节点的项目
+    int stateCount() const; // DFA节点个数
+    int forward(int, const std::string&) const;
+    int backward(int, const std::string&) const;
+    const std::string& getStart() const;
+
+    int symbolId(const std::string&) const; // 符号编号，不存在返回-1
+    int symbolId(char) const; // 单字符符号编号，不存在返回-1
+    const std::string& symbolName(int) const; // 编号对应的符号
+    int symbolCount() const; // 符号总数
+    int terminalCount() const; // 终结符号个数，编号[0, terminalCount)为终结符号
+    int forward(int, int) const; // 按符号编号查移进关系
+    int backward(int, int) const; // 按符号编号查规约关系
+    int defaultReduce(int) const; // 状态的默认规约项目，未开启defaultReduce或无则返回-1
+
+    int productionCount() const; // 推导式总数
+    int productionId(const std::string&, int) const; // 非终结符号第几条推导式的编号，不存在返回-1
+    int productionId(int, int) const; // DFA节点中某项目所属推导式的编号
+    const Production& getProduction(int) const; // 编号对应的推导式
+
+    ParsedResult parse(std::string, ParseProfile* profile = nullptr) const;
+    bool accepts(const std::string&, std::string* error = nullptr) const; // 只判断是否接受，不生成分析过程
+    // 并行判断是否接受：输入切成若干片，每片从可能的起始状态推测分析，再从左到右拼接，推测失败的片段顺序重做
+    // threads为0时取硬件线程数
+    bool acceptsParallel(const std::string&, int threads = 0, std::string* error = nullptr) const;
+
+    // 带语义动作的分析：值栈与状态栈同步，每次规约按推导式编号调用动作，不生成分析过程字符串
+    // 接收时result为开始符号的语义值；出错返回false，error(非空时)记录出错原因
+    template <typename Value>
+    bool evaluate(const std::string&, const SemanticActions<Value>&, Value& result, std::string* error = nullptr) const;
+};
+
+// 语义动作表，Value为语义值类型
+// 例：
+//   SemanticActions<int> actions(grammer);
+//   actions.shift = [](char c) { return c - '0'; };
+//   actions.on(grammer.productionId("E", 0), [](int* v, int) { return v[0] + v[2]; });
+//   int value;
+//   grammer.evaluate("1+2", actions, value);
+template <typename Value>
+struct SemanticActions {
+    typedef Value (*Shift)(char); // 移进动作：由输入字符构造语义值
+    typedef Value (*Reduce)(Value*, int); // 规约动作：右部各符号的语义值及个数 -> 左部语义值
+
+    Shift shift = nullptr; // 为空时移进的语义值为Value()
+    std::vector<Reduce> reduces; // 按推导式编号索引，为空时取右部第一个值(空串取Value())
+
+    explicit SemanticActions(const Grammer& grammer) : reduces(grammer.productionCount(), nullptr) {}
+
+    void on(int production, Reduce action) {
+        if (production >= 0 && production < (int)reduces.size())
+            reduces[production] = action;
+    }
 };
+
+template <typename Value>
+bool Grammer::evaluate(const std::string& input, const SemanticActions<Value>& actions, Value& result, std::string* error) const {
+    std::vector<int> states(1, 0); // 状态栈
+    std::vector<Value> values; // 值栈，比状态栈少一个初始状态
+    size_t pos = 0;
+    // 跳过空白，返回当前输入的符号编号
+    auto lookahead = [&]() -> int {
+        while (pos < input.size() && (input[pos] == ' ' || input[pos] == '\n'))
+            ++pos;
+        return pos < input.size() ? symbolId(input[pos]) : symbolId(END_FLAG);
+    };
+    if (bad() || forwardTable.empty()) {
+        if (error)
+            *error = getError();
+        return false;
+    }
+    int token = lookahead();
+    for (;;) {
+        int state = states.back();
+        int item = defaultReduce(state); // 默认规约不查输入
+        int next = item >= 0 ? -1 : forward(state, token);
+        if (next >= 0) {
+            // 移进
+            values.push_back(actions.shift ? actions.shift(input[pos]) : Value());
+            states.push_back(next);
+            ++pos;
+            token = lookahead();
+            continue;
+        }
+        if (item < 0)
+            item = backward(state, token);
+        if (item < 0) {
+            if (error) {
+                *error = "在状态" + std::to_string(state) + "上找不到" +
+                         (pos < input.size() ? std::string(1, input[pos]) : std::string(END_FLAG)) +
+                         "对应的移进/规约关系";
+            }
+            return false;
+        }
+        int id = itemProductions[state][item];
+        if (id == acceptProduction) {
+            // 接收
+            result = std::move(values.back());
+            return true;
+        }
+        const Production& production = productions[id];
+        Value* rhs = values.data() + values.size() - production.length;
+        Value value = actions.reduces[id] ? actions.reduces[id](rhs, production.length)
+                                          : (production.length ? std::move(*rhs) : Value());
+        values.erase(values.end() - production.length, values.end());
+        states.erase(states.end() - production.length, states.end());
+        values.push_back(std::move(value));
+        next = forward(states.back(), production.symbol);
+        if (next < 0) {
+            if (error)
+                *error = "在状态" + std::to_string(states.back()) + "上找不到" + production.key + "的转移";
+            return false;
+        }
+        states.push_back(next);
+    }
+}
+
+#endif // GRAMMER_H
@@ -1,9 +1,56 @@
 #include "mainwindow.h"
 
 #include <QApplication>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include "generator.h"
+#ifdef Q_OS_UNIX
+#include "parseserver.h"
+#endif
 
 int main(int argc, char *argv[])
 {
+    // 生成测试语料：LR_SLR --generate <文法文件> <句子数> [句长] [--invalid]，每行一句写到标准输出
+    if (argc >= 4 && std::string(argv[1]) == "--generate") {
+        std::ifstream file(argv[2]);
+        if (!file.is_open()) {
+            std::cerr << "无法打开文法文件" << argv[2] << std::endl;
+            return 1;
+        }
+        std::stringstream text;
+        text << file.rdbuf();
+        Grammer grammer(text.str());
+        GeneratorOptions options;
+        bool invalid = false;
+        for (int i = 4; i < argc; ++i) {
+            if (std::string(argv[i]) == "--invalid")
+                invalid = true;
+            else
+                options.length = std::strtoul(argv[i], nullptr, 10);
+        }
+        Generator generator(grammer, options);
+        if (grammer.bad() || !generator.valid() || (invalid && !grammer.slr())) {
+            std::cerr << (grammer.bad() ? grammer.getError() : !generator.valid() ? "开始符号推导不出句子" : "非SLR文法无法判断非法句子") << std::endl;
+            return 1;
+        }
+        generator.generate(std::cout, std::strtoul(argv[3], nullptr, 10), invalid);
+        return 0;
+    }
+#ifdef Q_OS_UNIX
+    // 守护进程模式：LR_SLR --daemon <套接字路径> [线程数]
+    if (argc >= 3 && std::string(argv[1]) == "--daemon") {
+        ParseServer server(argv[2], argc >= 4 ? std::atoi(argv[3]) : 0);
+        std::string error;
+        if (!server.start(&error)) {
+            std::cerr << error << std::endl;
+            return 1;
+        }
+        server.wait();
+        return 0;
+    }
+#endif
     QApplication a(argc, argv);
     MainWindow w;
     w.show();
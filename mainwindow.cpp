@@ -1,7 +1,16 @@
 #include "mainwindow.h"
 #include "ui_mainwindow.h"
+#include <QColor>
 #include <QFileDialog>
 #include <QMessageBox>
+#include <algorithm>
+
+// 热力图颜色：次数越多越红，未命中保持白色
+static QColor heatColor(unsigned long long count, unsigned long long max) {
+    if (!count || !max) return QColor(Qt::white);
+    int shade = 40 + 180 * count / max;
+    return QColor(255, 255 - shade, 255 - shade);
+}
 
 MainWindow::MainWindow(QWidget *parent)
     : QMainWindow(parent)
@@ -24,16 +33,26 @@ void MainWindow::renderBasicInfo() {
     Grammer& grammer = *currentGrammer;
     QString error = QString::fromStdString(grammer.getError());
     if (error.isEmpty()) error = "未发现错误";
+    for (const std::string& warning : grammer.getWarnings()) {
+        error += "\n警告: " + QString::fromStdString(warning);
+    }
     ui->syntaxError->setPlainText(error);
-    ui->syntaxType->setPlainText(grammer.slr() ? "SLR文法" : grammer.bad() ? "错误文法" : "LR文法\n" + QString::fromStdString(grammer.getReason()));
+    QString syntaxType = grammer.slr() ? "SLR文法" : grammer.bad() ? "错误文法" : "LR文法\n" + QString::fromStdString(grammer.getReason());
+    // 按优先级消解的移进规约冲突
+    for (const std::string& resolution : grammer.getResolutions()) {
+        syntaxType += "\n" + QString::fromStdString(resolution);
+    }
+    const MemoryUsage& memory = grammer.getMemoryUsage();
+    syntaxType += QString("\n分析表约%1 KB (构建峰值%2 KB)").arg(memory.current / 1024).arg(memory.peak / 1024);
+    ui->syntaxType->setPlainText(syntaxType);
     QString followSet, firstSet;
     // 渲染非终结节点的Follow集合和First集合
-    std::set<std::string> notEnd = grammer.getNotEnd();
-    for (std::string token : notEnd) {
+    const std::set<std::string>& notEnd = grammer.getNotEnd();
+    for (const std::string& token : notEnd) {
         firstSet += token + ": ";
         followSet += token + ": ";
-        std::set<std::string> firstOfToken = grammer.getFirst(token);
-        std::set<std::string> followOfToken = grammer.getFollow(token);
+        const std::set<std::string>& firstOfToken = grammer.getFirst(token);
+        const std::set<std::string>& followOfToken = grammer.getFollow(token);
         for (auto it = firstOfToken.begin(); it != firstOfToken.end();) {
             firstSet += *it;
             if (++it != firstOfToken.end()) firstSet += ", ";
@@ -59,10 +78,10 @@ void MainWindow::renderDfaTable() {
         return;
     }
     Grammer& grammer = *currentGrammer;
-    std::vector<std::vector<Node> > dfa = grammer.getDfa();
-    std::set<std::string> endSet = grammer.getEnd();
-    std::set<std::string> notEndSet = grammer.getNotEnd();
-    std::string startToken = grammer.getStart();
+    const std::vector<std::vector<Node> >& dfa = grammer.getDfa();
+    const std::set<std::string>& endSet = grammer.getEnd();
+    const std::set<std::string>& notEndSet = grammer.getNotEnd();
+    const std::string& startToken = grammer.getStart();
     auto* table = ui->dfa;
     table->setColumnCount(1+endSet.size()+notEndSet.size());
     table->setRowCount(dfa.size());
@@ -77,8 +96,6 @@ void MainWindow::renderDfaTable() {
     }
     table->setHorizontalHeaderLabels(header);
     table->horizontalHeader()->setSectionResizeMode(QHeaderView::Stretch);
-    // 文法
-    auto formula = grammer.getFormula();
     // 迭代生成cell
     for (int state = 0; state < (int)dfa.size(); ++state) {
         QTableWidgetItem *id = new QTableWidgetItem(); // 状态编号
@@ -90,13 +107,13 @@ void MainWindow::renderDfaTable() {
         QString innerText;
         for (int offset = 0; offset < (int)dfa[state].size(); ++offset) {
             // 遍历节点内部
-            Node& cur = dfa[state][offset];
-            std::vector<std::string> rawOfCur = formula[cur.key][cur.rawsIndex]; // 那一行文法
+            const Node& cur = dfa[state][offset];
+            const std::vector<std::string>& rawOfCur = grammer.getProductions(cur.key)[cur.rawsIndex]; // 那一行文法
             innerText += QString::fromStdString(cur.key) + " -> ";
             for (int tokenOffset = 0; tokenOffset <= (int)rawOfCur.size(); ++tokenOffset) {
                 // 构造类似A -> (.a)
                 if (tokenOffset == cur.rawIndex) innerText += ".";
-                innerText += QString::fromStdString(rawOfCur[tokenOffset]);
+                if (tokenOffset < (int)rawOfCur.size()) innerText += QString::fromStdString(rawOfCur[tokenOffset]);
             }
             innerText += "\n";
         }
@@ -134,11 +151,10 @@ void MainWindow::renderSlrTable() {
         return;
     }
     // 是SLR(1)文法
-    std::set<std::string> endSet = grammer.getEnd();
-    std::set<std::string> notEndSet = grammer.getNotEnd();
-    std::string startToken = grammer.getStart();
-    auto dfa = grammer.getDfa();
-    auto formula = grammer.getFormula();
+    std::set<std::string> endSet = grammer.getEnd(); // 需要加入END_FLAG，复制一份
+    const std::set<std::string>& notEndSet = grammer.getNotEnd();
+    const std::string& startToken = grammer.getStart();
+    const std::vector<std::vector<Node> >& dfa = grammer.getDfa();
     endSet.insert(END_FLAG);
 
     auto* table = ui->slr;
@@ -156,10 +172,29 @@ void MainWindow::renderSlrTable() {
     table->setHorizontalHeaderLabels(header);
     table->horizontalHeader()->setSectionResizeMode(QHeaderView::Stretch);
 
+    // 分析统计热力图：状态按命中总数着色，移进按状态的移进次数着色，规约按推导式的规约次数着色
+    bool heatmap = profile.runs > 0 && profile.shifts.size() >= dfa.size();
+    unsigned long long maxState = 0, maxShift = 0, maxProduction = 0;
+    if (heatmap) {
+        for (int state = 0; state < (int)dfa.size(); ++state) {
+            maxState = std::max(maxState, profile.shifts[state] + profile.reduces[state] + profile.errors[state]);
+            maxShift = std::max(maxShift, profile.shifts[state]);
+        }
+        for (auto count : profile.productions) {
+            maxProduction = std::max(maxProduction, count);
+        }
+    }
+
     // Cell
     for (int state = 0; state < (int)dfa.size(); ++state) {
         QTableWidgetItem *id = new QTableWidgetItem(); // 状态编号
         id->setText(QString::number(state));
+        if (heatmap) {
+            unsigned long long total = profile.shifts[state] + profile.reduces[state] + profile.errors[state];
+            id->setBackground(heatColor(total, maxState));
+            id->setToolTip(QString("移进%1次 规约%2次 出错%3次")
+                               .arg(profile.shifts[state]).arg(profile.reduces[state]).arg(profile.errors[state]));
+        }
         table->setItem(state, 0, id);
 
         int column = 1;
@@ -172,12 +207,12 @@ void MainWindow::renderSlrTable() {
                 table->setItem(state, column, end);
             } else if ((target = grammer.backward(state, token)) > -1) {
                 QTableWidgetItem *end = new QTableWidgetItem(); // 状态编号
-                Node& node = dfa[state][target];
+                const Node& node = dfa[state][target];
                 if (node.key == startToken) {
                     end->setText("ACCEPT");
                 } else {
                     QString endText = "r(" + QString::fromStdString(node.key) + "->";
-                    for (auto &token : formula[node.key][node.rawsIndex]) {
+                    for (auto &token : grammer.getProductions(node.key)[node.rawsIndex]) {
                         endText += QString::fromStdString(token);
                     }
                     endText += ")";
@@ -192,15 +227,21 @@ void MainWindow::renderSlrTable() {
             if (target > -1) {
                 QTableWidgetItem *end = new QTableWidgetItem(); // 状态编号
                 end->setText("s" + QString::number(target));
+                if (heatmap) end->setBackground(heatColor(profile.shifts[state], maxShift));
                 table->setItem(state, column, end);
             } else if ((target = grammer.backward(state, token)) > -1) {
                 QTableWidgetItem *end = new QTableWidgetItem(); // 状态编号
-                Node& node = dfa[state][target];
+                const Node& node = dfa[state][target];
+                if (heatmap) {
+                    unsigned long long count = profile.productions[grammer.productionId(state, target)];
+                    end->setBackground(heatColor(count, maxProduction));
+                    end->setToolTip(QString("规约%1次").arg(count));
+                }
                 if (node.key == startToken) {
                     end->setText("ACCEPT");
                 } else {
                     QString endText = "r(" + QString::fromStdString(node.key) + "->";
-                    for (auto &token : formula[node.key][node.rawsIndex]) {
+                    for (auto &token : grammer.getProductions(node.key)[node.rawsIndex]) {
                         endText += QString::fromStdString(token);
                     }
                     endText += ")";
@@ -217,7 +258,9 @@ void MainWindow::renderSlrTable() {
 void MainWindow::on_toParseGrammer_clicked() {
     std::string grammerStr = ui->grammer->toPlainText().toStdString();
     Grammer *grammer = new Grammer(grammerStr);
+    if (currentGrammer) delete currentGrammer;
     currentGrammer = grammer;
+    profile.reset(); // 统计只对当前文法有效
     renderBasicInfo();
     if (!grammer->bad()) {
         renderDfaTable();
@@ -278,7 +321,7 @@ void MainWindow::on_toParseStatement_clicked()
     }
     qDebug() << "待解析语句: " << statement;
     Grammer& grammer = *currentGrammer;
-    ParsedResult result = grammer.parse(statement.toStdString());
+    ParsedResult result = grammer.parse(statement.toStdString(), &profile);
     auto* table = ui->parseProcess;
     table->setColumnCount(3);
     table->setRowCount(result.outputs.size() + 1);
@@ -307,6 +350,25 @@ void MainWindow::on_toParseStatement_clicked()
         reason->setText(QString::fromStdString(result.error));
         table->setItem(result.outputs.size(), 1, reason);
     }
-
+    // 更新SLR分析表上的统计热力图
+    renderSlrTable();
 }
 
+void MainWindow::on_exportProfile_clicked()
+{
+    if (!currentGrammer || !profile.runs) {
+        QMessageBox::information(this, "提示", "请先分析语句后再导出统计");
+        return;
+    }
+    QString savePath = QFileDialog::getSaveFileName(this, "导出统计", QDir::homePath(), "CSV(*.csv)");
+    if (savePath.isEmpty())
+        return;
+    QFile file(savePath);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        QMessageBox::information(this, "提示", "统计导出失败");
+        return;
+    }
+    file.write(QByteArray::fromStdString(profile.toCsv(*currentGrammer)));
+    file.close();
+    QMessageBox::information(this, "提示", "统计导出成功");
+}
@@ -25,11 +25,14 @@ private slots:
 
     void on_toParseStatement_clicked();
 
+    void on_exportProfile_clicked();
+
 private:
     Ui::MainWindow *ui;
     void renderBasicInfo();
     void renderDfaTable();
     void renderSlrTable();
     Grammer* currentGrammer;
+    ParseProfile profile; // 当前文法的分析统计，跨多次分析累加
 };
 #endif // MAINWINDOW_H
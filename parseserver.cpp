@@ -0,0 +1,375 @@
+#include "parseserver.h"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstring>
+#include <sstream>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+using namespace std;
+
+// 单个请求的最大长度
+static const uint32_t MAX_FRAME = 256u << 20;
+// 保留的延迟样本数
+static const size_t LATENCY_SAMPLES = 8192;
+// 编译单个文法的DFA节点数与内存上限
+static const size_t MAX_STATES = 100000;
+static const size_t MAX_MEMORY = 512u << 20;
+// 缓存的文法个数上限
+static const size_t MAX_GRAMMERS = 256;
+
+// 读满len字节，连接关闭或出错返回false
+static bool readFull(int fd, void* buffer, size_t len) {
+    char* p = (char*)buffer;
+    while (len) {
+        ssize_t n = ::read(fd, p, len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        p += n;
+        len -= n;
+    }
+    return true;
+}
+
+static bool writeFull(int fd, const void* buffer, size_t len) {
+    const char* p = (const char*)buffer;
+    while (len) {
+        ssize_t n = ::write(fd, p, len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        p += n;
+        len -= n;
+    }
+    return true;
+}
+
+template <typename T>
+static void put(string& out, T value) {
+    out.append((const char*)&value, sizeof(T));
+}
+
+// 从in的pos处取一个T，越界返回false
+template <typename T>
+static bool take(const string& in, size_t& pos, T& value) {
+    if (in.size() - pos < sizeof(T)) return false;
+    memcpy(&value, in.data() + pos, sizeof(T));
+    pos += sizeof(T);
+    return true;
+}
+
+ParseServer::ParseServer(const string& path, int workers) : path(path), workerCount(workers) {
+    if (workerCount <= 0)
+        workerCount = max(1u, thread::hardware_concurrency());
+}
+
+ParseServer::~ParseServer() {
+    stop();
+}
+
+uint64_t ParseServer::hash(const string& text) {
+    // FNV-1a
+    uint64_t h = 1469598103934665603ULL;
+    for (unsigned char c : text) {
+        h ^= c;
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+bool ParseServer::start(string* error) {
+    sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(address.sun_path)) {
+        if (error) *error = "套接字路径过长";
+        return false;
+    }
+    strcpy(address.sun_path, path.c_str());
+    // 客户端断开时写入不应终止进程
+    signal(SIGPIPE, SIG_IGN);
+    listener = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener < 0) {
+        if (error) *error = string("创建套接字失败: ") + strerror(errno);
+        return false;
+    }
+    ::unlink(path.c_str());
+    if (::bind(listener, (sockaddr*)&address, sizeof(address)) < 0 || ::listen(listener, 64) < 0) {
+        if (error) *error = string("监听套接字失败: ") + strerror(errno);
+        ::close(listener);
+        listener = -1;
+        return false;
+    }
+    running = true;
+    for (int i = 0; i < workerCount; ++i) {
+        workers.emplace_back(&ParseServer::work, this);
+    }
+    acceptor = thread(&ParseServer::listen, this);
+    return true;
+}
+
+void ParseServer::stop() {
+    if (!running.exchange(false))
+        return;
+    // 关闭监听套接字和所有连接，使阻塞的accept/read返回
+    ::shutdown(listener, SHUT_RDWR);
+    ::close(listener);
+    listener = -1;
+    if (acceptor.joinable())
+        acceptor.join();
+    {
+        // 关闭连接后等待所有读写线程退出
+        unique_lock<mutex> lock(clientsMutex);
+        for (int fd : clients) {
+            ::shutdown(fd, SHUT_RDWR);
+        }
+        clientsDone.wait(lock, [this]() { return clients.empty(); });
+    }
+    jobsReady.notify_all();
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    workers.clear();
+    ::unlink(path.c_str());
+}
+
+void ParseServer::wait() {
+    if (acceptor.joinable())
+        acceptor.join();
+}
+
+void ParseServer::work() {
+    for (;;) {
+        function<void()> job;
+        {
+            unique_lock<mutex> lock(jobsMutex);
+            jobsReady.wait(lock, [this]() { return !jobs.empty() || !running; });
+            if (jobs.empty())
+                return;
+            job = move(jobs.front());
+            jobs.pop();
+        }
+        job();
+    }
+}
+
+void ParseServer::submit(function<void()> job) {
+    {
+        lock_guard<mutex> lock(jobsMutex);
+        jobs.push(move(job));
+    }
+    jobsReady.notify_one();
+}
+
+void ParseServer::listen() {
+    while (running) {
+        int fd = ::accept(listener, nullptr, nullptr);
+        if (fd < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        lock_guard<mutex> lock(clientsMutex);
+        clients.push_back(fd);
+        thread(&ParseServer::serve, this, fd).detach();
+    }
+}
+
+void ParseServer::serve(int fd) {
+    string request;
+    for (;;) {
+        uint32_t length;
+        if (!readFull(fd, &length, sizeof(length)) || length == 0 || length > MAX_FRAME)
+            break;
+        try {
+            request.resize(length);
+        } catch (const exception&) {
+            break; // 读不下这个请求，连接上的数据已无法对齐，只能断开
+        }
+        if (!readFull(fd, &request[0], length))
+            break;
+        string reply;
+        try {
+            reply = handle(request);
+        } catch (const exception&) {
+            // 服务由多个进程共享，任何请求都不能使其退出
+            reply.assign(1, (char)1);
+        }
+        uint32_t replyLength = reply.size();
+        if (!writeFull(fd, &replyLength, sizeof(replyLength)) || !writeFull(fd, reply.data(), reply.size()))
+            break;
+    }
+    lock_guard<mutex> lock(clientsMutex);
+    clients.erase(find(clients.begin(), clients.end(), fd));
+    ::close(fd);
+    clientsDone.notify_all();
+}
+
+string ParseServer::load(const string& text, uint64_t& id) {
+    static const string collision = "文法编号冲突：已缓存的另一文法与其哈希相同";
+    id = hash(text);
+    {
+        lock_guard<mutex> lock(grammersMutex);
+        auto it = grammers.find(id);
+        if (it != grammers.end()) {
+            if (it->second.text != text)
+                return collision;
+            recent.splice(recent.begin(), recent, it->second.used);
+            return "";
+        }
+    }
+    // 在锁外编译，编译期间不阻塞其他请求
+    // 文法来自客户端，限制构建规模，避免病态文法耗尽内存
+    GrammerOptions options;
+    options.maxStates = MAX_STATES;
+    options.maxMemory = MAX_MEMORY;
+    shared_ptr<const Grammer> grammer = make_shared<const Grammer>(text, options);
+    if (grammer->bad())
+        return grammer->getError();
+    if (!grammer->slr())
+        return "不是SLR(1)文法\n" + grammer->getReason();
+    lock_guard<mutex> lock(grammersMutex);
+    auto it = grammers.find(id);
+    if (it != grammers.end()) {
+        // 编译期间已被其他请求加入
+        return it->second.text == text ? "" : collision;
+    }
+    recent.push_front(id);
+    grammers.emplace(id, Cached{text, grammer, recent.begin()});
+    while (grammers.size() > MAX_GRAMMERS) {
+        // 淘汰最久未使用的文法，正在分析的请求仍持有其shared_ptr
+        grammers.erase(recent.back());
+        recent.pop_back();
+    }
+    return "";
+}
+
+shared_ptr<const Grammer> ParseServer::lookup(uint64_t id) {
+    lock_guard<mutex> lock(grammersMutex);
+    auto it = grammers.find(id);
+    if (it == grammers.end())
+        return nullptr;
+    recent.splice(recent.begin(), recent, it->second.used);
+    return it->second.grammer;
+}
+
+string ParseServer::handle(const string& request) {
+    auto begin = chrono::steady_clock::now();
+    string reply;
+    size_t pos = 0;
+    uint8_t op = 0;
+    take(request, pos, op);
+    switch (op) {
+    case OP_LOAD: {
+        uint64_t id;
+        string error = load(request.substr(pos), id);
+        put<uint8_t>(reply, error.empty() ? 0 : 1);
+        put<uint64_t>(reply, id);
+        reply += error;
+        break;
+    }
+    case OP_PARSE: {
+        uint64_t id;
+        uint32_t count;
+        shared_ptr<const Grammer> grammer;
+        // 每个句子至少有4字节的长度，句子数不可能超过剩余字节数的1/4
+        if (!take(request, pos, id) || !take(request, pos, count) || count > (request.size() - pos) / sizeof(uint32_t)
+            || !(grammer = lookup(id))) {
+            put<uint8_t>(reply, 1);
+            break;
+        }
+        // 先切出每个句子，再按线程数分片交给线程池
+        vector<pair<size_t, uint32_t> > sentences;
+        sentences.reserve(count);
+        for (uint32_t i = 0; i < count; ++i) {
+            uint32_t length;
+            if (!take(request, pos, length) || request.size() - pos < length)
+                break;
+            sentences.push_back(make_pair(pos, length));
+            pos += length;
+        }
+        if (sentences.size() != count) {
+            put<uint8_t>(reply, 1);
+            break;
+        }
+        vector<uint8_t> accepted(count, 0);
+        size_t slices = min<size_t>(workerCount, count);
+        size_t remaining = slices;
+        atomic<bool> failed{false};
+        mutex doneMutex;
+        condition_variable done;
+        for (size_t slice = 0; slice < slices; ++slice) {
+            submit([&, slice]() {
+                try {
+                    for (size_t i = slice; i < sentences.size(); i += slices) {
+                        accepted[i] = grammer->accepts(request.substr(sentences[i].first, sentences[i].second));
+                    }
+                } catch (const exception&) {
+                    failed = true; // 线程池线程中的异常同样不能使服务退出
+                }
+                lock_guard<mutex> lock(doneMutex);
+                if (--remaining == 0)
+                    done.notify_one();
+            });
+        }
+        {
+            unique_lock<mutex> lock(doneMutex);
+            done.wait(lock, [&]() { return remaining == 0; });
+        }
+        if (failed) {
+            put<uint8_t>(reply, 1);
+            break;
+        }
+        put<uint8_t>(reply, 0);
+        put<uint32_t>(reply, count);
+        reply.append((const char*)accepted.data(), accepted.size());
+        record(chrono::duration<double, micro>(chrono::steady_clock::now() - begin).count());
+        break;
+    }
+    case OP_STATS:
+        put<uint8_t>(reply, 0);
+        reply += stats();
+        break;
+    default:
+        put<uint8_t>(reply, 1);
+        break;
+    }
+    return reply;
+}
+
+void ParseServer::record(double micros) {
+    lock_guard<mutex> lock(latencyMutex);
+    requests++;
+    if (latencies.size() < LATENCY_SAMPLES) {
+        latencies.push_back(micros);
+    } else {
+        latencies[latencyNext] = micros;
+        latencyNext = (latencyNext + 1) % LATENCY_SAMPLES;
+    }
+}
+
+string ParseServer::stats() {
+    vector<double> samples;
+    unsigned long long total;
+    {
+        lock_guard<mutex> lock(latencyMutex);
+        samples = latencies;
+        total = requests;
+    }
+    size_t loaded;
+    {
+        lock_guard<mutex> lock(grammersMutex);
+        loaded = grammers.size();
+    }
+    stringstream ss;
+    ss << "grammers " << loaded << "\nrequests " << total << '\n';
+    if (!samples.empty()) {
+        sort(samples.begin(), samples.end());
+        // 取最近样本的分位数
+        auto percentile = [&](double p) { return samples[min(samples.size() - 1, (size_t)(p * samples.size()))]; };
+        ss << "p50 " << percentile(0.5) << "us\np90 " << percentile(0.9) << "us\np99 " << percentile(0.99)
+           << "us\nmax " << samples.back() << "us\n";
+    }
+    return ss.str();
+}
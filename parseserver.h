@@ -0,0 +1,89 @@
+#ifndef PARSESERVER_H
+#define PARSESERVER_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "grammer.h"
+
+// 本机分析服务：在Unix域套接字上为多个进程共享已编译的文法
+//
+// 协议(本机字节序)：每个请求/应答为 u32 长度 + 内容
+//   请求 u8 操作码 + 参数
+//     LOAD  (1) 文法文本                      -> u8 状态, u64 文法编号, [出错信息]
+//     PARSE (2) u64 文法编号, u32 句子数, 每句 u32 长度 + 句子
+//                                             -> u8 状态, u32 句子数, 每句 u8 是否接受
+//     STATS (3)                               -> u8 状态, 统计文本
+//   状态 0 成功，1 出错
+// 文法编号为文法文本的哈希，相同文本只编译一次；哈希相同而文本不同时LOAD出错
+// 只接受SLR(1)文法；最多缓存若干个文法，最久未使用的先淘汰，淘汰后PARSE出错，需要重新LOAD
+class ParseServer {
+public:
+    enum Op : uint8_t {
+        OP_LOAD = 1,
+        OP_PARSE = 2,
+        OP_STATS = 3
+    };
+
+    ParseServer(const std::string& path, int workers = 0); // workers为0时取硬件线程数
+    ~ParseServer();
+
+    bool start(std::string* error = nullptr); // 监听套接字并启动线程
+    void stop(); // 停止服务
+    void wait(); // 阻塞到服务停止
+    std::string stats(); // 已编译文法数、请求数及延迟分位数
+
+    static uint64_t hash(const std::string&); // 文法编号
+
+private:
+    std::string path; // 套接字路径
+    int listener = -1;
+    std::atomic<bool> running{false};
+
+    struct Cached {
+        std::string text; // 文法文本，命中时比较以排除哈希冲突
+        std::shared_ptr<const Grammer> grammer;
+        std::list<uint64_t>::iterator used; // 在recent中的位置
+    };
+    std::mutex grammersMutex;
+    std::unordered_map<uint64_t, Cached> grammers; // 已编译的文法
+    std::list<uint64_t> recent; // 文法编号，最近使用的在前
+
+    // 线程池
+    std::vector<std::thread> workers;
+    std::queue<std::function<void()> > jobs;
+    std::mutex jobsMutex;
+    std::condition_variable jobsReady;
+    int workerCount;
+
+    std::thread acceptor; // 接受连接的线程
+    std::mutex clientsMutex;
+    std::condition_variable clientsDone;
+    std::vector<int> clients; // 正在服务的连接，每个连接一个读写线程
+
+    // 延迟统计，保留最近的若干次请求
+    std::mutex latencyMutex;
+    std::vector<double> latencies; // 微秒
+    size_t latencyNext = 0;
+    unsigned long long requests = 0;
+
+    void work(); // 线程池线程
+    void listen(); // 接受连接
+    void serve(int); // 处理一个连接上的请求
+    void submit(std::function<void()>); // 提交任务到线程池
+    void record(double); // 记录一次请求延迟
+    std::string load(const std::string&, uint64_t&); // 编译或取出缓存的文法，返回出错信息
+    std::shared_ptr<const Grammer> lookup(uint64_t); // 取出已编译的文法，不存在返回空
+    std::string handle(const std::string&); // 处理一个请求，返回应答
+};
+
+#endif // PARSESERVER_H